@@ -0,0 +1,153 @@
+// Batch analysis: FEN or EPD lines in, one result per position out, in input order. Positions are whole position
+// jobs spread over all workers, at most inflight of them are read ahead, so the input can be a stream of any length.
+// analyze [file | -] [depth N | movetime ms | nodes N] [inflight N] [binary] [out file]
+// Results are JSON lines, or AnalyzeRecords with binary. Without a file (or with -) the positions come from stdin,
+// meant for the command line: ./muller analyze movetime 100 < positions.epd > scores.jsonl
+
+// Binary result, native byte order. pv holds pv_len legal moves from the position, pv[0] is the best move.
+struct AnalyzeRecord {
+	uint32_t index;		// 0 based input position
+	int32_t score;		// side to move, with flag 8 or 1 a mate in p plies is +-(INT32_MAX / 2 - p)
+	uint64_t nodes;
+	uint32_t ms;
+	uint8_t depth;
+	uint8_t pv_len;
+	uint8_t flags;		// 1: mate, 2: stalemate, 4: bad position line, 8: mate by the pv or the tables, score holds the distance
+	uint8_t reserved;
+	Move pv[MAX_DEPTH];
+};
+static_assert(sizeof(AnalyzeRecord) == 56, "AnalyzeRecord should be 56 bytes");
+
+struct AnalyzeItem {
+	EpdPosition p;
+	Board b;
+	bool white;
+	bool done = false;
+	RootResult r{};
+	uint8_t flags = 0;
+};
+
+static string jsonString(const string &s) {
+	string r = "\"";
+	for (char c : s)
+		if (c == '"' || c == '\\')
+			r += string("\\") + c;
+		else if (uint8_t(c) >= 0x20)
+			r += c;
+	return r + "\"";
+}
+
+void writeAnalyzed(ostream &out, uint32_t index, AnalyzeItem &a, bool binary) {
+	AnalyzeRecord rec{};
+	rec.index = index;
+	rec.flags = a.flags;
+	if (!a.flags) {
+		rec.score = a.r.best.score;
+		rec.nodes = a.r.evals;
+		rec.ms = a.r.ms_taken;
+		rec.depth = a.r.depth;
+		bool mated;
+		rec.pv_len = Game::legalLine(a.b, a.white, a.r.best, a.r.depth, rec.pv, mated);
+		// a mate score holds the depth left at the king capture, the distance comes from the line or the tables
+		int plies = mated ? rec.pv_len : tbMatePlies(rec.score, rec.depth);
+		if (plies) {
+			rec.score = plies % 2 ? INT32_MAX / 2 - plies : -INT32_MAX / 2 + plies;
+			rec.flags |= 8;
+		}
+	} else if (a.flags & 1)
+		rec.score = -INT32_MAX / 2; // mated, mate 0
+	if (binary) {
+		out.write((const char *)&rec, sizeof(rec));
+		return;
+	}
+	out << "{\"index\":" << index << ",\"fen\":" << jsonString(a.p.fen);
+	if (!a.p.id.empty())
+		out << ",\"id\":" << jsonString(a.p.id);
+	if (a.flags & 4) {
+		out << ",\"error\":\"no position\"}\n";
+		return;
+	}
+	int mate_plies = INT32_MAX / 2 - abs(rec.score);
+	if (rec.flags & 9) // moves, negative when the side to move gets mated
+		out << ",\"mate\":" << (rec.score > 0 ? (mate_plies + 1) / 2 : -mate_plies / 2);
+	else
+		out << ",\"cp\":" << rec.score;
+	Board b = a.b;
+	out << ",\"bestmove\":";
+	if (rec.pv_len == 0)
+		out << "null";
+	string pv;
+	for (int i = 0; i < rec.pv_len; i++) {
+		string m = b.move2str(rec.pv[i]);
+		m.pop_back(); // move2str ends with a blank
+		if (i == 0)
+			out << "\"" << m << "\"";
+		pv += (i ? ",\"" : "\"") + m + "\"";
+		E_PIECE took;
+		b = b.move(rec.pv[i], took);
+	}
+	out << ",\"pv\":[" << pv << "],\"depth\":" << int(rec.depth) << ",\"nodes\":" << rec.nodes << ",\"time\":" << rec.ms;
+	if (a.flags & 3)
+		out << ",\"status\":\"" << (a.flags & 1 ? "mate" : "stalemate") << "\"";
+	out << "}\n";
+}
+
+void runAnalyze(istream &in, ostream &out, bool binary, int depth, uint32_t movetime, uint32_t nodes, int inflight) {
+	int workers = max(1, cpu_count - 1);
+	if (inflight <= 0)
+		inflight = 4 * workers;
+	RootSearch rs;
+	map<uint32_t, AnalyzeItem> window; // read and not written yet, at most inflight
+	uint32_t read = 0, written = 0;
+	uint64_t total_nodes = 0;
+	bool eof = false;
+	string line;
+	auto t_start = now();
+	RootResult r;
+	while (!eof || !window.empty()) {
+		while (!eof && int(window.size()) < inflight) {
+			if (!getline(in, line)) {
+				eof = true;
+				break;
+			}
+			if (line.find_first_not_of(" \t\r") == string::npos)
+				continue;
+			AnalyzeItem &a = window[read];
+			if (!parseEpd(line, a.p)) {
+				a.p.fen = line;
+				a.flags = 4;
+				a.done = true;
+			} else {
+				Game g(a.p.fen);
+				a.b = g.current;
+				a.white = g.white_to_move;
+				Move moves[128];
+				Board boards[128];
+				if (!MateSolver::legal(a.b, a.white, moves, boards)) {
+					a.flags = MateSolver::inCheck(a.b, a.white) ? 1 : 2;
+					a.done = true;
+				} else
+					rs.submit(a.b, a.white, depth, movetime, nodes, read, limits.pos_score_enabled);
+			}
+			read++;
+		}
+		bool any = false;
+		for (auto it = window.begin(); it != window.end() && it->first == written && it->second.done; it = window.erase(it)) {
+			writeAnalyzed(out, written++, it->second, binary);
+			any = true;
+		}
+		if (any)
+			out.flush();
+		if (rs.poll(r)) {
+			auto &a = window[r.tag];
+			a.r = r;
+			a.done = true;
+			total_nodes += r.evals;
+		} else if (!any)
+			sleep_us(50);
+	}
+	uint64_t ms = since(t_start);
+	cerr << "info string analyzed " << written << " positions in " << ms << " ms, " << written * 1000.0 / (ms + 1) << " positions/s, "
+		 << total_nodes << " nodes, " << total_nodes * 1000 / (ms + 1) << " nps" << endl;
+	ResetStats();
+}
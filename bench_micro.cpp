@@ -0,0 +1,141 @@
+#include "muller.hpp"
+#include <x86intrin.h>
+#include <random>
+#include <cmath>
+
+/**
+ * @brief Time per call of the Board primitives.
+ * @details The corpus is a few test positions plus the positions of random games played from them with a fixed
+ * seed. Every primitive runs over the whole corpus, a few warm-up rounds first, then timed rounds. Reported are
+ * the median ns and TSC cycles per call, the fastest round and the spread (stddev / mean) of the rounds.
+ * Single thread, no MPI.
+ *
+ * ./bench_micro [rounds]
+ **/
+
+struct Sample {
+	Board b;
+	bool white;
+	vector<Move> moves;	// pseudo legal
+};
+
+vector<Sample> corpus;
+volatile uint64_t sink;
+
+void buildCorpus() {
+	const char *fens[] = {
+		"rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1",
+		"r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq - 0 1",
+		"r1bq1rk1/pp2bppp/2n2n2/3p4/3P4/2NB1N2/PP3PPP/R1BQ1RK1 w - - 0 9",
+		"8/2p5/3p4/KP5r/1R3p1k/8/4P1P1/8 w - - 0 1",
+		"3nk3/8/3B1K2/8/8/6Q1/8/8 w - - 0 1",
+	};
+	mt19937 rng(42);
+	for (auto fen : fens)
+		for (int game = 0; game < 20; game++) {
+			Game g(fen);
+			for (int ply = 0; ply < 60; ply++) {
+				Sample s{g.current, g.white_to_move, {}};
+				MoveArray moves;
+				int n = s.b.moves(s.white, moves);
+				s.moves.assign(moves, moves + n);
+				corpus.push_back(s);
+				auto legal = g.getValidMoves();
+				if (legal.empty())
+					break;
+				E_PIECE took;
+				g.current = g.current.move(legal[rng() % legal.size()], took);
+				g.white_to_move = !g.white_to_move;
+			}
+		}
+}
+
+// op works on one sample and returns the number of calls it made
+template<typename F> void measure(const char *name, int rounds, F op) {
+	vector<double> ns, cycles;
+	uint64_t calls = 0;
+	for (int r = -3; r < rounds; r++) { // negative rounds warm up
+		calls = 0;
+		auto t = steady_clock::now();
+		uint64_t c = __rdtsc();
+		for (auto &s : corpus)
+			calls += op(s);
+		c = __rdtsc() - c;
+		double us = duration<double, nano>(steady_clock::now() - t).count();
+		if (r >= 0) {
+			ns.push_back(us / calls);
+			cycles.push_back(double(c) / calls);
+		}
+	}
+	double mean = 0, var = 0;
+	for (double v : ns)
+		mean += v / ns.size();
+	for (double v : ns)
+		var += (v - mean) * (v - mean) / ns.size();
+	auto median = [](vector<double> v) { sort(v.begin(), v.end()); return v[v.size() / 2]; };
+	printf("%-20s %9.2f ns %9.1f cycles  min %9.2f ns  spread %5.1f%%  %8lu calls/round\n", name, median(ns), median(cycles),
+			*min_element(ns.begin(), ns.end()), 100 * sqrt(var) / mean, calls);
+}
+
+int main(int argc, char *argv[]) {
+	int rounds = argc > 1 ? max(1, atoi(argv[1])) : 15;
+	buildCorpus();
+	size_t moves = 0;
+	for (auto &s : corpus)
+		moves += s.moves.size();
+	printf("%zu positions, %zu moves, %d rounds\n", corpus.size(), moves, rounds);
+
+	measure("moves", rounds, [](Sample &s) {
+		MoveArray m;
+		sink = s.b.moves(s.white, m);
+		return 1;
+	});
+	measure("move", rounds, [](Sample &s) {
+		E_PIECE took;
+		for (Move m : s.moves)
+			sink = s.b.move(m, took).position;
+		return s.moves.size();
+	});
+	measure("removeFast+insert", rounds, [](Sample &s) {
+		Board b = s.b;
+		int n = 0;
+		for (uint64_t pos = s.b.position; pos; pos &= pos - 1, n++) {
+			int sq = countr_zero(pos);
+			E_PIECE pc = get_pc(n, s.b.pieces_single);
+			b.removeFast(sq, n);
+			b.insert(pc, sq);
+		}
+		sink = b.pieces[0];
+		return n;
+	});
+	measure("get_pcidx", rounds, [](Sample &s) {
+		uint64_t sum = 0;
+		for (int sq = 0; sq < 64; sq++)
+			sum += get_pcidx(s.b.position, sq);
+		sink = sum;
+		return 64;
+	});
+	measure("getPiece", rounds, [](Sample &s) {
+		uint64_t sum = 0;
+		for (int sq = 0; sq < 64; sq++)
+			sum += s.b.getPiece(sq);
+		sink = sum;
+		return 64;
+	});
+	limits.pos_score_enabled = false;
+	measure("eval", rounds, [](Sample &s) {
+		sink = s.b.eval();
+		return 1;
+	});
+	limits.pos_score_enabled = true;
+	limits.pawn_hash_bits = 0;
+	measure("eval posscore", rounds, [](Sample &s) {
+		sink = s.b.eval();
+		return 1;
+	});
+	measure("isCheck", rounds, [](Sample &s) {
+		sink = s.b.isCheck(s.white);
+		return 1;
+	});
+	return 0;
+}
@@ -0,0 +1,192 @@
+// Endgame tables for king and queen, rook or pawn against the lone king, built by retrograde analysis.
+// One byte per position: plies to mate + 1 for the strong side, 0 for a draw. Rank 0 builds them once with all
+// cores and keeps them in ENG_TB_FILE, every rank then maps that file read only. f_pvs probes them once three
+// pieces are left, king and minor piece against king is a draw without a table.
+
+#include <unistd.h>
+
+#define TB_SIZE (2 * 64 * 64 * 64)  // weak side to move, strong king, weak king, piece
+#define TB_ILLEGAL 0xFF
+#define TB_WIN (INT32_MAX / 2 - 64) // below the king capture scores, a search that sees the mate prefers it
+
+enum E_TB { TB_KQK, TB_KRK, TB_KPK, TB_COUNT };
+
+// Plies to mate of a score from the tables, 0 for any other score. A table score holds the depth left at the
+// probe, TB_WIN + depth - dtm, and the probe is as many plies below the root as the root has more depth, so
+// with the root at lot index depth the distance is depth + TB_WIN - |score|.
+static inline int tbMatePlies(int32_t score, int depth) {
+    int32_t s = abs(score);
+    return s > TB_WIN - 256 && s <= TB_WIN + MAX_DEPTH ? depth + TB_WIN - s : 0;
+}
+
+// Layout of the table file, read in place through mmap
+struct TbFile {
+    char magic[8]; // "MULLTB02"
+    uint8_t dtm[TB_COUNT][TB_SIZE];
+};
+
+static inline int tbIndex(bool weak_to_move, int sk, int wk, int p) { return ((weak_to_move * 64 + sk) * 64 + wk) * 64 + p; }
+
+struct Bitbases {
+    const TbFile *file = nullptr;
+    unique_ptr<TbFile> built; // no file could be written
+
+    // Squares the piece attacks, the weak king does not block its own escape
+    static uint64_t pieceAttacks(int t, int p, uint64_t occupied) {
+        if (t == TB_KPK)
+            return attack_tables.pawn[1][p];
+        uint64_t a = 0;
+        for (int d = 0; d < 8; d += t == TB_KRK ? 2 : 1)
+            a |= attack_tables.slide(d, p, occupied);
+        return a;
+    }
+
+    // Fills dtm[t] up to plies + 1 == level + 1, returns true if anything changed. Strong to move positions get even
+    // values and look at weak to move ones, which get odd values, so a level only reads what it does not write.
+    static bool step(TbFile &f, int t, int level, int from, int to) {
+        uint8_t *dtm = f.dtm[t];
+        bool changed = false;
+        for (int i = from; i < to; i++) {
+            if (dtm[i] != 0)
+                continue;
+            int p = i & 63, wk = (i >> 6) & 63, sk = (i >> 12) & 63;
+            bool weak = i >> 18;
+            if (weak == (level % 2 == 1))
+                continue;
+            if (!weak) { // one move into a position mated in level plies is enough
+                bool found = false;
+                for (uint64_t to_ = attack_tables.king[sk] & ~attack_tables.king[wk] & ~(1ULL << p); to_ && !found; to_ &= to_ - 1)
+                    found = dtm[tbIndex(true, countr_zero(to_), wk, p)] == level;
+                uint64_t occupied = (1ULL << sk) | (1ULL << wk);
+                if (t != TB_KPK)
+                    for (uint64_t to_ = pieceAttacks(t, p, occupied) & ~occupied; to_ && !found; to_ &= to_ - 1)
+                        found = dtm[tbIndex(true, sk, wk, countr_zero(to_))] == level;
+                else if (!found && !(occupied & (1ULL << (p + 8)))) {
+                    if (p + 8 >= 56) // promotion, the engine only promotes to a queen and that table is complete
+                        found = f.dtm[TB_KQK][tbIndex(true, sk, wk, p + 8)] == level;
+                    else
+                        found = dtm[tbIndex(true, sk, wk, p + 8)] == level ||
+                                (p < 16 && !(occupied & (1ULL << (p + 16))) && dtm[tbIndex(true, sk, wk, p + 16)] == level);
+                }
+                if (found) {
+                    dtm[i] = level + 1;
+                    changed = true;
+                }
+            } else { // every reply must be lost, the slowest in level plies
+                uint64_t attacked = pieceAttacks(t, p, 1ULL << sk);
+                uint64_t to_ = attack_tables.king[wk] & ~attack_tables.king[sk] & ~(attacked & ~(1ULL << p));
+                if (!to_ || to_ & (1ULL << p)) // no moves is decided already, taking the piece draws
+                    continue;
+                int slowest = 0;
+                for (; to_ && slowest != TB_ILLEGAL; to_ &= to_ - 1) {
+                    int v = dtm[tbIndex(false, sk, countr_zero(to_), p)];
+                    slowest = v == 0 ? TB_ILLEGAL : max(slowest, v);
+                }
+                if (slowest == level) {
+                    dtm[i] = level + 1;
+                    changed = true;
+                }
+            }
+        }
+        return changed;
+    }
+
+    static void generate(TbFile &f, int t) {
+        uint8_t *dtm = f.dtm[t];
+        for (int i = 0; i < TB_SIZE; i++) {
+            int p = i & 63, wk = (i >> 6) & 63, sk = (i >> 12) & 63;
+            bool weak = i >> 18;
+            uint64_t occupied = (1ULL << sk) | (1ULL << wk);
+            dtm[i] = 0;
+            if (sk == wk || sk == p || wk == p || attack_tables.king[sk] & (1ULL << wk) || (t == TB_KPK && (p < 8 || p >= 56)))
+                dtm[i] = TB_ILLEGAL;
+            else if (!weak && pieceAttacks(t, p, occupied) & (1ULL << wk))
+                dtm[i] = TB_ILLEGAL; // weak king in check and strong to move
+            else if (weak) {
+                uint64_t attacked = pieceAttacks(t, p, 1ULL << sk);
+                if (!(attack_tables.king[wk] & ~attack_tables.king[sk] & ~(attacked & ~(1ULL << p))))
+                    dtm[i] = (pieceAttacks(t, p, occupied) & (1ULL << wk)) ? 1 : 0; // mate or stalemate
+            }
+        }
+        int workers = max(1u, thread::hardware_concurrency());
+        for (int level = 1, idle = 0; level < TB_ILLEGAL - 1 && idle < 2; level++) {
+            atomic<bool> changed = false;
+            vector<thread> threads;
+            for (int w = 0; w < workers; w++)
+                threads.emplace_back([&, w]() {
+                    if (step(f, t, level, TB_SIZE / workers * w, w == workers - 1 ? TB_SIZE : TB_SIZE / workers * (w + 1)))
+                        changed = true;
+                });
+            for (auto &th : threads)
+                th.join();
+            idle = changed ? 0 : idle + 1;
+        }
+    }
+
+    bool map(const string &filename) {
+        auto m = mapFile(filename, sizeof(TbFile), sizeof(TbFile), "MULLTB02");
+        if (m.empty())
+            return false;
+        file = (const TbFile *)m.data();
+        return true;
+    }
+
+    // Maps the file, or builds the tables and writes the file for the other ranks and the next start
+    void load(const string &filename) {
+        if (map(filename))
+            return;
+        auto t_start = now();
+        built = make_unique<TbFile>();
+        memcpy(built->magic, "MULLTB02", 8);
+        for (int t = 0; t < TB_COUNT; t++)
+            generate(*built, t);
+        file = built.get();
+        string tmp = filename + "." + to_string(getpid());
+        ofstream out(tmp, ios::binary);
+        if (out.write((const char *)built.get(), sizeof(TbFile)) && (out.close(), rename(tmp.c_str(), filename.c_str()) == 0) && map(filename))
+            built.reset();
+        else
+            remove(tmp.c_str());
+        if (crank == 0)
+            cout << "info string endgame tables built in " << since(t_start) << " ms" << endl;
+    }
+
+    // Score for the side to move at depth, false if the position is not covered
+    bool probe(Board &b, bool white, int depth, int32_t &score) {
+        int kings[2] = {-1, -1}, sq = -1; // [1] white
+        E_PIECE pc = P_EMPTY;
+        auto pcs = b.pieces_single;
+        for (uint64_t pos = b.position; pos; pos &= pos - 1) {
+            E_PIECE x = E_PIECE(uint8_t(pcs) & 0xF);
+            pcs >>= 4;
+            if (x == W_KING || x == B_KING)
+                kings[x == W_KING] = countr_zero(pos);
+            else {
+                pc = x;
+                sq = countr_zero(pos);
+            }
+        }
+        if (kings[0] < 0 || kings[1] < 0)
+            return false;
+        int t;
+        switch (pc) {
+        case P_EMPTY: case W_BISHOP: case B_BISHOP: case W_KNIGHT: case B_KNIGHT:
+            score = 0;
+            return true;
+        case W_QUEEN: case B_QUEEN: t = TB_KQK; break;
+        case W_ROOK: case B_ROOK: t = TB_KRK; break;
+        default: t = TB_KPK;
+        }
+        if (!file)
+            return false;
+        bool strong_white = pc < 8;
+        int flip = strong_white ? 0 : 56; // black's pawn runs up the board in the table
+        int v = file->dtm[t][tbIndex(white != strong_white, kings[strong_white] ^ flip, kings[!strong_white] ^ flip, sq ^ flip)];
+        if (v == TB_ILLEGAL)
+            return false;
+        score = v == 0 ? 0 : TB_WIN + depth - (v - 1);
+        if (v != 0 && white != strong_white)
+            score = -score;
+        return true;
+    }
+} bitbases;
@@ -0,0 +1,147 @@
+// Polyglot opening book, read by rank 0 only. The .bin file is mapped and binary searched in place, entries are
+// 16 bytes big endian and sorted by key. Keys need Polyglot's 781 Random64 numbers, read as hex from
+// ENG_BOOK_KEYS_FILE, every 0x number in it (the array from Polyglot's random.c can be pasted in as it is).
+
+#include <random>
+
+#define BOOK_RANDOMS 781 // 12 x 64 pieces, 4 castling, 8 en passant files, 1 side to move
+
+struct BookEntry {
+    uint64_t key;
+    uint16_t move;
+    uint16_t weight;
+    uint32_t learn;
+};
+
+static inline uint64_t bigEndian(const uint8_t *p, int n) {
+    uint64_t v = 0;
+    for (int i = 0; i < n; i++)
+        v = (v << 8) | p[i];
+    return v;
+}
+
+struct Book {
+    const uint8_t *data = nullptr;
+    size_t size = 0, n = 0;
+    vector<uint64_t> random;
+    mt19937 rng{random_device{}()};
+
+    // Every token with 0x in it is a key, the rest of random.c around them is skipped. The start position
+    // has a known key, a wrong or shifted array would load and never match.
+    bool loadKeys(const string &filename) {
+        ifstream in(filename);
+        string token;
+        random.clear();
+        while (in >> token && random.size() < BOOK_RANDOMS) {
+            size_t at = token.find("0x");
+            if (at == string::npos)
+                at = token.find("0X");
+            if (at == string::npos || at + 2 >= token.size() || !isxdigit(token[at + 2]))
+                continue;
+            random.push_back(stoull(token.substr(at + 2), nullptr, 16));
+        }
+        if (random.size() == BOOK_RANDOMS) {
+            Game start;
+            if (key(start.current, start.white_to_move) == 0x463b96181691fc9cULL)
+                return true;
+            cout << "info string " << filename << " does not hash the start position to Polyglot's key" << endl;
+        }
+        random.clear();
+        return false;
+    }
+
+    void close() {
+        unmapFile({data, size});
+        data = nullptr;
+        size = n = 0;
+    }
+
+    bool open(const string &filename) {
+        close();
+        if (filename.empty() || filename == "<empty>")
+            return false;
+        if (random.empty() && !loadKeys(ENG_BOOK_KEYS_FILE)) {
+            cout << "info string no Polyglot keys in " << ENG_BOOK_KEYS_FILE << ", book off" << endl;
+            return false;
+        }
+        auto m = mapFile(filename, 16);
+        if (m.empty()) {
+            cout << "info string can't map book " << filename << endl;
+            return false;
+        }
+        data = m.data();
+        size = m.size();
+        n = size / 16;
+        cout << "info string book " << filename << " with " << n << " entries" << endl;
+        return true;
+    }
+
+    BookEntry entry(size_t i) {
+        const uint8_t *e = data + 16 * i;
+        return {bigEndian(e, 8), uint16_t(bigEndian(e + 8, 2)), uint16_t(bigEndian(e + 10, 2)), uint32_t(bigEndian(e + 12, 4))};
+    }
+
+    // Polyglot's key: piece kinds ordered black pawn, white pawn, black knight, ... white king.
+    // En passant only counts if a pawn of the side to move can take.
+    uint64_t key(Board &b, bool white) {
+        static const int8_t kind[16] = {-1, 1, 11, 9, 7, 5, 3, -1, 6, 4, 2, 10, 8, 0, -1, -1};
+        uint64_t k = 0;
+        auto pcs = b.pieces_single;
+        for (uint64_t pos = b.position; pos; pos &= pos - 1) {
+            int pc = kind[uint8_t(pcs) & 0xF];
+            pcs >>= 4;
+            if (pc >= 0)
+                k ^= random[64 * pc + countr_zero(pos)];
+        }
+        for (int c = 0; c < 4; c++)
+            if (b.game_flags & (1 << c)) // W_CK, W_CQ, B_CK, B_CQ like Polyglot
+                k ^= random[768 + c];
+        int ep = b.enpassant_square;
+        if (ep < 64) {
+            int pawn_sq = white ? ep - 8 : ep + 8;
+            E_PIECE own = white ? W_PAWN : B_PAWN;
+            if ((get_file(ep) > 0 && b.getPiece(pawn_sq - 1) == own) || (get_file(ep) < 7 && b.getPiece(pawn_sq + 1) == own))
+                k ^= random[772 + get_file(ep)];
+        }
+        if (white)
+            k ^= random[780];
+        return k;
+    }
+
+    // Book move weighted by the entries' weights, 0 if there is none. Castling comes as king takes rook,
+    // under-promotions are left out since moves always promote to a queen here.
+    Move probe(Board &b, bool white) {
+        if (!data)
+            return 0;
+        uint64_t k = key(b, white);
+        size_t lo = 0, hi = n;
+        while (lo < hi) {
+            size_t mid = (lo + hi) / 2;
+            if (bigEndian(data + 16 * mid, 8) < k)
+                lo = mid + 1;
+            else
+                hi = mid;
+        }
+        vector<pair<Move, int>> candidates;
+        int total = 0;
+        for (size_t i = lo; i < n && bigEndian(data + 16 * i, 8) == k; i++) {
+            BookEntry e = entry(i);
+            int promotion = (e.move >> 12) & 7;
+            if (promotion != 0 && promotion != 4)
+                continue;
+            int to = e.move & 0x3F, from = (e.move >> 6) & 0x3F;
+            E_PIECE pc = b.getPiece(from);
+            if ((pc == W_KING || pc == B_KING) && b.getPiece(to) == (pc == W_KING ? W_ROOK : B_ROOK))
+                to = to > from ? from + 2 : from - 2;
+            candidates.push_back({move_encode(from, to), e.weight});
+            total += e.weight;
+        }
+        if (candidates.empty())
+            return 0;
+        int pick = total > 0 ? uniform_int_distribution<int>(0, total - 1)(rng) : 0;
+        for (auto &[m, w] : candidates)
+            if ((pick -= w) < 0)
+                return m;
+        return candidates[0].first;
+    }
+} book;
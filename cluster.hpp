@@ -0,0 +1,521 @@
+// Rank 0 <-> worker transport. Jobs travel in batches over persistent requests using a compact
+// wire format, results come back one message per job so rank 0 sees every subtree as soon as it is done.
+// A rank is topped up once half its queue is free, so with JobBatch 4 or more a message carries several jobs.
+
+#define JOB_MAX_BATCH 8   // max jobs per message and max jobs queued at one rank
+#define TAG_JOB 0
+#define TAG_RESULT 1
+#define TAG_HISTORY 2
+
+enum E_JOB_FLAGS {
+	JOB_WHITE_TO_MOVE = 1,
+	JOB_MATE_SEARCH   = 2,
+	JOB_POS_SCORE     = 4,
+	JOB_CLEAR_TABLES  = 8,	// forget everything kept from earlier jobs (new game)
+	JOB_HISTORY       = 16,	// repetition history of the search was sent ahead of this job
+	JOB_ROOT          = 32,	// whole position, the worker deepens up to depth within movetime and nodes
+};
+
+// 24 byte board, en passant square and castling flags are folded into the header. The limits of whole
+// position jobs follow, 40 byte total.
+struct WireJob {
+	uint64_t pieces[2];
+	uint64_t position;
+	uint16_t id;		// sender's job id, echoed in the result
+	uint8_t depth;
+	uint8_t enpassant_square;
+	uint8_t game_flags;
+	uint8_t flags;		// E_JOB_FLAGS
+	uint8_t epoch;		// search generation, a new one clears the halt flag on the worker
+	uint8_t cache_bits;	// eval cache (low nibble) and pawn hash (high nibble) size, see packCacheBits
+	uint32_t movetime;	// JOB_ROOT: ms from the start of the job, 0 = no limit
+	uint32_t nodes;		// JOB_ROOT: evals, 0 = no limit
+};
+static_assert(sizeof(WireJob) == 40, "WireJob should be 40 bytes");
+
+// Result of one job, pv holds lot[0..pv_len-1] of the search result
+struct WireResult {
+	uint16_t id;
+	uint8_t halted;
+	uint8_t pv_len;
+	int32_t score;
+	uint64_t evals;
+	uint32_t ms_taken;
+	uint16_t depth;
+	uint32_t eval_probes, eval_hits, pawn_probes, pawn_hits;
+#ifdef ENG_STATS
+	SearchStats stats;
+#endif
+	Move pv[MAX_DEPTH];	// pv_len moves, over MPI only those are sent
+};
+
+static inline int wireSize(const WireResult &w) { return offsetof(WireResult, pv) + w.pv_len * sizeof(Move); }
+
+WireJob packJob(const Board &b, bool white_to_move, int depth, uint8_t flags) {
+	WireJob j{};
+	j.pieces[0] = b.pieces[0];
+	j.pieces[1] = b.pieces[1];
+	j.position = b.position;
+	j.depth = depth;
+	j.enpassant_square = b.enpassant_square;
+	j.game_flags = b.game_flags;
+	j.flags = flags | (white_to_move ? JOB_WHITE_TO_MOVE : 0);
+	return j;
+}
+
+// log2 sizes in a nibble each, 0 = off, eval cache 10..24, pawn hash 8..22
+uint8_t packCacheBits(int eval_bits, int pawn_bits) {
+	return (eval_bits ? clamp(eval_bits, 10, 24) - 9 : 0) | (pawn_bits ? clamp(pawn_bits, 8, 22) - 7 : 0) << 4;
+}
+
+void unpackCacheBits(uint8_t bits, int &eval_bits, int &pawn_bits) {
+	eval_bits = bits & 0xF ? (bits & 0xF) + 9 : 0;
+	pawn_bits = bits >> 4 ? (bits >> 4) + 7 : 0;
+}
+
+Board unpackBoard(const WireJob &j) {
+	Board b;
+	b.pieces[0] = j.pieces[0];
+	b.pieces[1] = j.pieces[1];
+	b.position = j.position;
+	b.enpassant_square = j.enpassant_square;
+	b.game_flags = j.game_flags;
+	b.pst_score = b.pstScore();
+	return b;
+}
+
+WireResult packResult(const EvalResult &r, uint64_t evals, uint32_t ms_taken, bool halted) {
+	WireResult w{};
+	w.score = r.score;
+	w.depth = r.depth;
+	w.evals = evals;
+	w.ms_taken = ms_taken;
+	w.halted = halted;
+	int d = MAX_DEPTH;
+	while (d > 0 && r.lot[d - 1] == 0) d--;
+	w.pv_len = d;
+	for (int i = 0; i < d; i++)
+		w.pv[i] = r.lot[i];
+	return w;
+}
+
+EvalResult unpackResult(const WireResult &w) {
+	EvalResult r{};
+	r.score = w.score;
+	r.depth = w.depth;
+	for (int i = 0; i < w.pv_len; i++)
+		r.lot[i] = w.pv[i];
+	return r;
+}
+
+// Single producer / single consumer ring, lives in memory both sides can see (node shared segment)
+template<typename T, int N> struct SpscRing {
+	alignas(64) uint32_t head;	// next write, producer only
+	alignas(64) uint32_t tail;	// next read, consumer only
+	T items[N];
+
+	bool push(const T &item) {
+		uint32_t h = atomic_ref(head).load(memory_order_relaxed);
+		if (h - atomic_ref(tail).load(memory_order_acquire) == N)
+			return false;
+		items[h % N] = item;
+		atomic_ref(head).store(h + 1, memory_order_release);
+		return true;
+	}
+
+	bool pop(T &item) {
+		uint32_t t = atomic_ref(tail).load(memory_order_relaxed);
+		if (atomic_ref(head).load(memory_order_acquire) == t)
+			return false;
+		item = items[t % N];
+		atomic_ref(tail).store(t + 1, memory_order_release);
+		return true;
+	}
+};
+
+// Mailbox of a worker that shares the node with rank 0, or of a worker thread
+struct JobSlot {
+	SpscRing<WireJob, 2 * JOB_MAX_BATCH> jobs;
+	SpscRing<WireResult, 2 * JOB_MAX_BATCH> results;
+	alignas(64) int halt;		// engine_halt of the worker
+	int quit;					// worker threads only, leave the loop
+	int history_len;
+	uint64_t history[REP_MAX];	// written before the JOB_HISTORY job is pushed
+};
+
+struct QueuedJob {
+	WireJob job;
+	bool shm;	// answer through the shared slot
+};
+
+// Rank 0 view of the workers. Every rank gets one persistent send request per batch size and one
+// persistent receive for its results that is restarted after each completion. Ranks on rank 0's node
+// bypass MPI and use their JobSlot in the node shared segment.
+// In threaded mode (single process, or built with ENG_NO_MPI) the workers are threads of this process,
+// rank n is thread n and talks through its JobSlot only.
+struct Cluster {
+#ifndef ENG_NO_MPI
+	vector<array<WireJob, JOB_MAX_BATCH>> outbox;
+	vector<array<MPI_Request, JOB_MAX_BATCH>> send_req;
+	vector<int> send_active;	// batch size of the send in flight, 0 if none
+	vector<WireResult> inbox;
+	vector<MPI_Request> recv_req;
+	vector<MPI_Request> history_req;
+	MPI_Win node_win;
+#endif
+	vector<int> inflight;		// jobs sent to the rank and not answered yet
+	int capacity = 2;			// jobs queued per rank, > 1 hides the dispatch latency behind the running job
+	uint64_t messages = 0, jobs = 0;
+	vector<JobSlot *> slot;		// world rank -> slot in the node shared segment, nullptr if remote
+	vector<bool> clear_tables;	// next job to the rank carries JOB_CLEAR_TABLES
+	bool fresh_tables = false;	// every job carries it, node counts no longer depend on which rank got which job
+	uint8_t epoch = 0;			// search generation, counted here for everything that sends jobs
+	uint16_t next_job_id = 0;	// unique across all senders, a result finds its sender by the id
+	deque<pair<WireResult, int>> stash;	// results and their ranks, not picked up by their sender yet
+	uint32_t history_serial = 0;
+	vector<uint32_t> rank_history;	// serial of the repetition history the rank holds, 0 = none
+#ifndef ENG_NO_MPI
+	vector<vector<uint64_t>> history_out;	// keys on their way to the rank
+#endif
+#ifdef ENG_STATS
+	vector<SearchStats> rank_stats;	// search counters of every result from the rank, see UCIstats
+#endif
+	bool use_shm = true;
+	bool threaded = false;
+	vector<JobSlot> thread_slots;
+	vector<thread> threads;
+
+	void startThreads(int n);	// in game.hpp, needs the worker loop
+	void stopThreads();
+
+#ifndef ENG_NO_MPI
+	// Collective on all ranks. Sets up the shared segment of rank 0's node, one JobSlot per node-local rank.
+	void initNode() {
+		MPI_Comm node_comm;
+		int node_rank, node_size, node_root = crank;
+		MPI_Comm_split_type(MPI_COMM_WORLD, MPI_COMM_TYPE_SHARED, crank, MPI_INFO_NULL, &node_comm);
+		MPI_Comm_rank(node_comm, &node_rank);
+		MPI_Comm_size(node_comm, &node_size);
+		MPI_Bcast(&node_root, 1, MPI_INT, 0, node_comm);
+		bool rank0_node = node_root == 0; // key is the world rank, so rank 0 is local root of its node
+		JobSlot *slots;
+		MPI_Aint size = rank0_node && node_rank == 0 ? node_size * sizeof(JobSlot) : 0;
+		MPI_Win_allocate_shared(size, 1, MPI_INFO_NULL, node_comm, (void *)&slots, &node_win);
+		slot.assign(cpu_count, nullptr);
+		if (!rank0_node)
+			return;
+		int disp_unit;
+		MPI_Win_shared_query(node_win, 0, &size, &disp_unit, (void *)&slots);
+		if (node_rank == 0)
+			for (int i = 0; i < node_size; i++)
+				new (&slots[i]) JobSlot{};
+		vector<int> world_rank(node_size);
+		MPI_Allgather(&crank, 1, MPI_INT, world_rank.data(), 1, MPI_INT, node_comm);
+		MPI_Barrier(node_comm);
+		for (int i = 0; i < node_size; i++)
+			slot[world_rank[i]] = &slots[i];
+	}
+#endif
+
+	void init() {
+		inflight.assign(cpu_count, 0);
+		clear_tables.assign(cpu_count, false);
+		rank_history.assign(cpu_count, 0);
+#ifdef ENG_STATS
+		rank_stats.assign(cpu_count, {});
+#endif
+		if (threaded)
+			return;
+#ifndef ENG_NO_MPI
+		outbox.resize(cpu_count);
+		send_req.resize(cpu_count);
+		send_active.assign(cpu_count, 0);
+		inbox.resize(cpu_count);
+		recv_req.assign(cpu_count, MPI_REQUEST_NULL);
+		history_req.assign(cpu_count, MPI_REQUEST_NULL);
+		history_out.resize(cpu_count);
+		for (int rank = 1; rank < cpu_count; rank++) {
+			send_req[rank].fill(MPI_REQUEST_NULL);
+			MPI_Recv_init((void *)&inbox[rank], sizeof(WireResult), MPI_BYTE, rank, TAG_RESULT, MPI_COMM_WORLD, &recv_req[rank]);
+			MPI_Start(&recv_req[rank]);
+		}
+#endif
+	}
+
+	// None until half the queue is free, the refill then goes out as one message
+	int freeSlots(int rank) {
+		return inflight[rank] > capacity / 2 ? 0 : capacity - inflight[rank];
+	}
+
+	void clearTables() {
+		clear_tables.assign(cpu_count, true);
+	}
+
+	// A game's repetition history gets a serial per search and goes with the first job to a rank that holds
+	// another one. A worker on rank 0's node reads the keys from its slot only when it starts that job, so a new
+	// history waits until the rank is idle.
+	uint32_t newHistory() { return ++history_serial; }
+
+	bool canSend(int rank, uint32_t history) {
+		return !history || rank_history[rank] == history || inflight[rank] == 0 || !((use_shm || threaded) && slot[rank]);
+	}
+
+	// One message per call, jobs are copied so the caller's buffer can be reused right away.
+	// keys: the history with that serial, root last.
+	void send(int rank, WireJob *jobs_, int n, uint32_t history = 0, const vector<uint64_t> *keys = nullptr) {
+		if (clear_tables[rank] || fresh_tables) {
+			for (int i = 0; i < (fresh_tables ? n : 1); i++)
+				jobs_[i].flags |= JOB_CLEAR_TABLES;
+			clear_tables[rank] = false;
+		}
+		bool shm = (use_shm || threaded) && slot[rank];
+		if (history && rank_history[rank] != history) {
+			jobs_[0].flags |= JOB_HISTORY;
+			rank_history[rank] = history;
+			int len = min<int>(keys->size(), REP_MAX);
+			if (shm) {
+				copy(keys->end() - len, keys->end(), slot[rank]->history);
+				slot[rank]->history_len = len;
+			}
+#ifndef ENG_NO_MPI
+			else { // same sender and communicator, MPI keeps it ahead of the jobs
+				MPI_Wait(&history_req[rank], MPI_STATUS_IGNORE);
+				history_out[rank].assign(keys->end() - len, keys->end());
+				MPI_Isend((void *)history_out[rank].data(), len, MPI_UINT64_T, rank, TAG_HISTORY, MPI_COMM_WORLD, &history_req[rank]);
+			}
+#endif
+		} else if (!history)
+			for (int i = 0; i < n; i++)
+				if (jobs_[i].flags & JOB_ROOT)
+					rank_history[rank] = 0; // the worker forgets its history for a root job without one
+		inflight[rank] += n;
+		messages++;
+		jobs += n;
+		if (shm) {
+			for (int i = 0; i < n; i++)
+				slot[rank]->jobs.push(jobs_[i]); // never full, inflight <= capacity
+			return;
+		}
+#ifndef ENG_NO_MPI
+		if (send_active[rank])
+			MPI_Wait(&send_req[rank][send_active[rank] - 1], MPI_STATUS_IGNORE);
+		auto &req = send_req[rank][n - 1];
+		if (req == MPI_REQUEST_NULL)
+			MPI_Send_init((void *)outbox[rank].data(), n * sizeof(WireJob), MPI_BYTE, rank, TAG_JOB, MPI_COMM_WORLD, &req);
+		copy(jobs_, jobs_ + n, outbox[rank].begin());
+		MPI_Start(&req);
+		send_active[rank] = n;
+#endif
+	}
+
+	// Returns true and fills result/rank if any job finished
+	bool poll(WireResult &result, int &rank) {
+		for (rank = 1; rank < cpu_count; rank++)
+			if (slot[rank] && inflight[rank] > 0 && slot[rank]->results.pop(result)) {
+				inflight[rank]--;
+				return true;
+			}
+		if (threaded)
+			return false;
+#ifndef ENG_NO_MPI
+		int idx, done = 0;
+		MPI_Testany(cpu_count, recv_req.data(), &idx, &done, MPI_STATUS_IGNORE);
+		if (!done || idx == MPI_UNDEFINED)
+			return false;
+		rank = idx;
+		result = inbox[rank];
+		inflight[rank]--;
+		MPI_Start(&recv_req[rank]);
+		return true;
+#endif
+		return false;
+	}
+
+	// Offers every result that came in to claim(result, rank), the ones it does not take wait for their sender
+	template<typename F> void receive(F claim) {
+		WireResult w;
+		int rank;
+		while (poll(w, rank)) {
+#ifdef ENG_STATS
+			rank_stats[rank].add(w.stats);
+#endif
+			stash.push_back({w, rank});
+		}
+		for (auto it = stash.begin(); it != stash.end();)
+			it = claim(it->first, it->second) ? stash.erase(it) : next(it);
+	}
+
+	// Stops the jobs of that search generation on the rank
+	void halt(int rank, uint8_t epoch_) {
+		if (slot[rank]) {
+			atomic_ref(slot[rank]->halt).store(HALT_TOKEN(epoch_), memory_order_relaxed);
+			return;
+		}
+#ifndef ENG_NO_MPI
+		int x = HALT_TOKEN(epoch_);
+		MPI_Put((void *)&x, 1, MPI_INT, rank, 0, 1, MPI_INT, eng_halt_win);
+#endif
+	}
+} cluster;
+
+// Worker view of rank 0: persistent receive of job batches and persistent send of results,
+// or the JobSlot if the worker shares the node with rank 0 or is a thread
+struct WorkerLink {
+#ifndef ENG_NO_MPI
+	array<WireJob, JOB_MAX_BATCH> inbox;
+	WireResult outbox;
+	MPI_Request recv_req;
+	array<MPI_Request, MAX_DEPTH + 1> send_req;	// one per pv length
+	int send_active = 0;	// pv length + 1 of the send in flight, 0 if none
+#endif
+	JobSlot *slot;
+	bool mpi;
+
+	void init(JobSlot *thread_slot) {
+		slot = thread_slot ? thread_slot : cluster.slot[crank];
+		mpi = !thread_slot;
+		if (slot)
+			engine_halt = &slot->halt;
+#ifndef ENG_NO_MPI
+		if (!mpi)
+			return;
+		MPI_Recv_init((void *)inbox.data(), sizeof(inbox), MPI_BYTE, 0, TAG_JOB, MPI_COMM_WORLD, &recv_req);
+		send_req.fill(MPI_REQUEST_NULL);
+		MPI_Start(&recv_req);
+#endif
+	}
+
+	// Appends received jobs to q, non-blocking
+	void poll(deque<QueuedJob> &q) {
+		WireJob job;
+		if (slot)
+			while (slot->jobs.pop(job))
+				q.push_back({job, true});
+#ifndef ENG_NO_MPI
+		if (!mpi)
+			return;
+		int done = 0;
+		MPI_Status status;
+		MPI_Test(&recv_req, &done, &status);
+		if (!done)
+			return;
+		int bytes;
+		MPI_Get_count(&status, MPI_BYTE, &bytes);
+		for (int i = 0; i < bytes / int(sizeof(WireJob)); i++)
+			q.push_back({inbox[i], false});
+		MPI_Start(&recv_req);
+#endif
+	}
+
+	// Called for a JOB_HISTORY job, the keys are already there
+	void history(RepHistory &rep, bool shm) {
+		if (shm) {
+			rep.set(slot->history, slot->history_len);
+			return;
+		}
+#ifndef ENG_NO_MPI
+		uint64_t keys[REP_MAX];
+		MPI_Status status;
+		int len;
+		MPI_Recv((void *)keys, REP_MAX, MPI_UINT64_T, 0, TAG_HISTORY, MPI_COMM_WORLD, &status);
+		MPI_Get_count(&status, MPI_UINT64_T, &len);
+		rep.set(keys, len);
+#endif
+	}
+
+	void send(const WireResult &r, bool shm) {
+		if (shm) {
+			slot->results.push(r);
+			return;
+		}
+#ifndef ENG_NO_MPI
+		if (send_active)
+			MPI_Wait(&send_req[send_active - 1], MPI_STATUS_IGNORE);
+		auto &req = send_req[r.pv_len];
+		if (req == MPI_REQUEST_NULL)
+			MPI_Send_init((void *)&outbox, wireSize(r), MPI_BYTE, 0, TAG_RESULT, MPI_COMM_WORLD, &req);
+		outbox = r;
+		MPI_Start(&req);
+		send_active = r.pv_len + 1;
+#endif
+	}
+};
+
+// Whole positions as jobs for the batch modes (epd, analyze, match). Each goes to one worker, which deepens on
+// its own, results come back in completion order with the caller's tag. At most capacity jobs wait per rank.
+struct RootResult {
+	uint64_t tag;
+	EvalResult best;	// score for the side to move, move and line in lot[depth..1]
+	int depth;			// last finished iteration
+	uint64_t evals;
+	uint32_t ms_taken;
+};
+
+struct RootSearch {
+	struct Queued {
+		WireJob job;
+		uint32_t history;				// serial of keys, 0 if none
+		vector<uint64_t> keys;			// game keys before the position
+	};
+	deque<Queued> queue;				// not sent yet
+	unordered_map<uint16_t, uint64_t> tags;	// job id -> tag of the jobs out
+	uint8_t epoch = ++cluster.epoch;	// a fresh generation forgets an earlier stop on the workers
+
+	void submit(const Board &b, bool white, int depth, uint32_t movetime, uint32_t nodes, uint64_t tag, bool pos_score,
+	            vector<uint64_t> history = {}) {
+		WireJob job = packJob(b, white, min(depth, MAX_DEPTH - 1), JOB_ROOT | (pos_score ? JOB_POS_SCORE : 0));
+		job.id = cluster.next_job_id++;
+		job.epoch = epoch;
+		job.cache_bits = packCacheBits(limits.eval_cache_bits, limits.pawn_hash_bits);
+		job.movetime = movetime;
+		job.nodes = nodes;
+		tags[job.id] = tag;
+		queue.push_back({job, history.empty() ? 0 : cluster.newHistory(), move(history)});
+	}
+
+	size_t pending() { return tags.size(); }
+
+	// Drops the jobs not sent yet and stops the ones out, their results still come in
+	void cancel() {
+		for (auto &q : queue)
+			tags.erase(q.job.id);
+		queue.clear();
+		for (int rank = 1; rank < cpu_count; rank++)
+			if (cluster.inflight[rank] > 0)
+				cluster.halt(rank, epoch);
+	}
+
+	// Sends what fits, returns true and fills r if a job finished. A job with history goes alone, see canSend.
+	bool poll(RootResult &r) {
+		for (int rank = 1; rank < cpu_count && !queue.empty(); rank++) {
+			WireJob batch[JOB_MAX_BATCH];
+			int n = 0;
+			if (queue.front().history) {
+				Queued &q = queue.front();
+				if (cluster.freeSlots(rank) <= 0 || !cluster.canSend(rank, q.history))
+					continue;
+				cluster.send(rank, &q.job, 1, q.history, &q.keys);
+				queue.pop_front();
+				continue;
+			}
+			for (; n < cluster.freeSlots(rank) && !queue.empty() && !queue.front().history; queue.pop_front())
+				batch[n++] = queue.front().job;
+			if (n > 0)
+				cluster.send(rank, batch, n);
+		}
+		bool got = false;
+		cluster.receive([&](WireResult &w, int) {
+			if (got || !tags.count(w.id))
+				return false;
+			r.tag = tags[w.id];
+			tags.erase(w.id);
+			r.best = unpackResult(w);
+			r.depth = w.pv_len > 0 ? w.pv_len - 1 : 0;
+			r.best.move = r.depth > 0 ? r.best.lot[r.depth] : 0;
+			r.evals = w.evals;
+			r.ms_taken = w.ms_taken;
+			return got = true;
+		});
+		return got;
+	}
+};
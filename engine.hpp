@@ -24,8 +24,11 @@ struct LimitsType {
   TimePoint time[2], inc[2], npmsec, movetime, startTime;
   int movestogo, depth, mate_search, perft, infinite;
   uint64_t nodes;
-  bool pos_score_enabled, debug_mainline;
-} limits = {};
+  bool pos_score_enabled, debug_mainline, ponder;
+  int eval_cache_bits, pawn_hash_bits; // log2 entries, 0 = off
+  int multipv;                         // root moves reported in info lines
+};
+thread_local LimitsType limits = {}; // per worker thread, jobs carry their own settings
 
 
 // piece numbers and values. 
@@ -64,6 +67,112 @@ enum E_GFLAGS_VAL {
 const int32_t value[16] = {0, 100, INT32_MAX/2, 900, 500, 300, 300,  0,  -500, -300, -300, -INT32_MAX/2, -900, -100, 0, 0};
 //const int32_t value[16] = {0, 100, INT32_MAX/2, INT32_MAX/2, 900, 500, 300, 300, 100, 500, 300, 300, INT32_MAX/2, INT32_MAX/2, 900};
 
+// Piece-square tables, indexed by piece and square, white perspective. Given for white pieces with rank 8
+// first like a FEN, black gets the mirrored and negated table, so a board keeps one sum for both sides.
+struct PieceSquareTables {
+    static constexpr int MAX_ENTRY = 1000; // 32 pieces at most, so Board::pst_score always fits its int16_t
+    int16_t score[16][64];
+
+    // Returns false if an entry had to be clamped to MAX_ENTRY
+    bool set(E_PIECE pc, const int16_t *table, int weight = 100) {
+        E_PIECE black = blackPiece(pc);
+        bool fits = true;
+        auto weighted = [&](int v) {
+            int64_t w = int64_t(v) * weight / 100;
+            fits &= abs(w) <= MAX_ENTRY;
+            return int16_t(clamp<int64_t>(w, -MAX_ENTRY, MAX_ENTRY));
+        };
+        for (int sq = 0; sq < 64; sq++) {
+            score[pc][sq] = weighted(table[(7 - sq / 8) * 8 + sq % 8]);
+            score[black][sq] = -weighted(table[sq]);
+        }
+        return fits;
+    }
+
+    static E_PIECE blackPiece(E_PIECE pc) {
+        switch (pc) {
+        case W_PAWN: return B_PAWN;
+        case W_KING: return B_KING;
+        case W_QUEEN: return B_QUEEN;
+        case W_ROOK: return B_ROOK;
+        case W_BISHOP: return B_BISHOP;
+        default: return B_KNIGHT;
+        }
+    }
+
+    // Simplified evaluation function tables (T. Michniewski), king middle game
+    PieceSquareTables() {
+        static const int16_t pawn[64] = {
+             0,  0,  0,  0,  0,  0,  0,  0,   50, 50, 50, 50, 50, 50, 50, 50,
+            10, 10, 20, 30, 30, 20, 10, 10,    5,  5, 10, 25, 25, 10,  5,  5,
+             0,  0,  0, 20, 20,  0,  0,  0,    5, -5,-10,  0,  0,-10, -5,  5,
+             5, 10, 10,-20,-20, 10, 10,  5,    0,  0,  0,  0,  0,  0,  0,  0};
+        static const int16_t knight[64] = {
+           -50,-40,-30,-30,-30,-30,-40,-50,  -40,-20,  0,  0,  0,  0,-20,-40,
+           -30,  0, 10, 15, 15, 10,  0,-30,  -30,  5, 15, 20, 20, 15,  5,-30,
+           -30,  0, 15, 20, 20, 15,  0,-30,  -30,  5, 10, 15, 15, 10,  5,-30,
+           -40,-20,  0,  5,  5,  0,-20,-40,  -50,-40,-30,-30,-30,-30,-40,-50};
+        static const int16_t bishop[64] = {
+           -20,-10,-10,-10,-10,-10,-10,-20,  -10,  0,  0,  0,  0,  0,  0,-10,
+           -10,  0,  5, 10, 10,  5,  0,-10,  -10,  5,  5, 10, 10,  5,  5,-10,
+           -10,  0, 10, 10, 10, 10,  0,-10,  -10, 10, 10, 10, 10, 10, 10,-10,
+           -10,  5,  0,  0,  0,  0,  5,-10,  -20,-10,-10,-10,-10,-10,-10,-20};
+        static const int16_t rook[64] = {
+             0,  0,  0,  0,  0,  0,  0,  0,    5, 10, 10, 10, 10, 10, 10,  5,
+            -5,  0,  0,  0,  0,  0,  0, -5,   -5,  0,  0,  0,  0,  0,  0, -5,
+            -5,  0,  0,  0,  0,  0,  0, -5,   -5,  0,  0,  0,  0,  0,  0, -5,
+            -5,  0,  0,  0,  0,  0,  0, -5,    0,  0,  0,  5,  5,  0,  0,  0};
+        static const int16_t queen[64] = {
+           -20,-10,-10, -5, -5,-10,-10,-20,  -10,  0,  0,  0,  0,  0,  0,-10,
+           -10,  0,  5,  5,  5,  5,  0,-10,   -5,  0,  5,  5,  5,  5,  0, -5,
+             0,  0,  5,  5,  5,  5,  0, -5,  -10,  5,  5,  5,  5,  5,  0,-10,
+           -10,  0,  5,  0,  0,  0,  0,-10,  -20,-10,-10, -5, -5,-10,-10,-20};
+        static const int16_t king[64] = {
+           -30,-40,-40,-50,-50,-40,-40,-30,  -30,-40,-40,-50,-50,-40,-40,-30,
+           -30,-40,-40,-50,-50,-40,-40,-30,  -30,-40,-40,-50,-50,-40,-40,-30,
+           -20,-30,-30,-40,-40,-30,-30,-20,  -10,-20,-20,-20,-20,-20,-20,-10,
+            20, 20,  0,  0,  0,  0, 20, 20,   20, 30, 10,  0,  0, 10, 30, 20};
+        memset(score, 0, sizeof(score));
+        set(W_PAWN, pawn);
+        set(W_KNIGHT, knight);
+        set(W_BISHOP, bishop);
+        set(W_ROOK, rook);
+        set(W_QUEEN, queen);
+        set(W_KING, king);
+    }
+
+    // Text file with a block per piece: letter (PNBRQK), weight in percent, 64 values with rank 8 first.
+    // # starts a comment. Pieces not in the file keep the built-in table. Returns false if the file can't be read.
+    bool load(const string &filename) {
+        ifstream in(filename);
+        if (!in)
+            return false;
+        stringstream tokens;
+        string line;
+        while (getline(in, line))
+            tokens << line.substr(0, line.find('#')) << ' ';
+        const string letters = "PNBRQK";
+        const E_PIECE pieces[6] = {W_PAWN, W_KNIGHT, W_BISHOP, W_ROOK, W_QUEEN, W_KING};
+        char letter;
+        while (tokens >> letter) {
+            int weight, n = 0;
+            int16_t table[64];
+            auto idx = letters.find(letter);
+            if (tokens >> weight)
+                while (n < 64 && tokens >> table[n])
+                    n++;
+            if (idx == string::npos || n != 64) {
+                cout << "info string " << filename << ": bad table for " << letter << endl;
+                return false;
+            }
+            if (!set(pieces[idx], table, weight))
+                cout << "info string " << filename << ": " << letter << " values clamped to +-" << MAX_ENTRY << endl;
+        }
+        cout << "info string piece-square tables from " << filename << endl;
+        return true;
+    }
+} pst;
+
 // bit op helpers
 //static inline bool has_bit(uint64_t &x, int bitNum) { return x & (1ULL << bitNum); }
 static inline bool has_bit(uint64_t x, int bitNum) { return x & (1ULL << bitNum); }
@@ -85,11 +194,11 @@ static inline uint16_t move_encode(uint8_t from, uint8_t to) { return ((uint16_t
 const __uint128_t u128_one = 1;
 const __uint128_t u128_4one = 0b1111;
 
-// Global stats
-uint64_t evals = 0;
-uint64_t ab_cuts = 0;
-uint64_t checks = 0;
-uint64_t stales = 0;
+// Global stats, per thread in threaded mode
+thread_local uint64_t evals = 0;
+thread_local uint64_t ab_cuts = 0;
+thread_local uint64_t checks = 0;
+thread_local uint64_t stales = 0;
 void ResetStats() {evals = ab_cuts = checks = stales = 0;};
 
 // castling moves
@@ -129,6 +238,112 @@ bool operator> (const EvalResult& c1, const EvalResult& c2) { return operator<(c
 // Returns all possible moves with a score, highest first. Empty means either mate or stale
 typedef vector<EvalResult> ExtendedEvalResult;
 
+#ifdef ENG_STATS
+// f_pvs counters of a job, summed per rank on rank 0. Ply 0 is the position of the job.
+struct SearchStats {
+    uint64_t nodes[MAX_DEPTH + 1];          // f_pvs calls by ply, leaves included
+    uint64_t cuts, first_cuts, cut_index;   // beta cutoffs, those by the first move, sum of the move index that cut
+    uint64_t null_windows, researches;      // PVS null window searches, those searched again with the full window
+
+    void add(const SearchStats &o) {
+        for (int i = 0; i <= MAX_DEPTH; i++)
+            nodes[i] += o.nodes[i];
+        cuts += o.cuts;
+        first_cuts += o.first_cuts;
+        cut_index += o.cut_index;
+        null_windows += o.null_windows;
+        researches += o.researches;
+    }
+};
+thread_local SearchStats search_stats{};
+thread_local int stats_root_depth = 0; // depth of ply 0, the ply of a node is what it has searched less
+#endif
+
+
+// Per thread caches in front of the eval. Sizes come with every job and only reallocate when they change.
+const int16_t passed_bonus[8] = {0, 5, 10, 20, 35, 60, 100, 0}; // by rank from the pawn's side
+
+struct EvalCacheEntry {
+    uint32_t check;     // upper half of the key
+    int32_t score;
+};
+
+struct PawnEntry {
+    uint64_t white, black;  // the pawns themselves, no collisions
+    int32_t score;
+};
+
+struct EvalTables {
+    vector<EvalCacheEntry> eval;
+    vector<PawnEntry> pawn;
+    uint64_t eval_probes = 0, eval_hits = 0, pawn_probes = 0, pawn_hits = 0;
+
+    void resize(int eval_bits, int pawn_bits) {
+        size_t n = eval_bits ? 1ULL << eval_bits : 0;
+        if (eval.size() != n)
+            eval.assign(n, {0xFFFFFFFF, 0});
+        n = pawn_bits ? 1ULL << pawn_bits : 0;
+        if (pawn.size() != n)
+            pawn.assign(n, {~0ULL, ~0ULL, 0});
+    }
+
+    bool probeEval(uint64_t key, int32_t &score) {
+        eval_probes++;
+        auto &e = eval[key & (eval.size() - 1)];
+        if (e.check != uint32_t(key >> 32))
+            return false;
+        eval_hits++;
+        score = e.score;
+        return true;
+    }
+
+    void storeEval(uint64_t key, int32_t score) {
+        eval[key & (eval.size() - 1)] = {uint32_t(key >> 32), score};
+    }
+
+    // Doubled and isolated pawns cost, passed pawns gain by rank. White's view.
+    static int32_t pawnStructure(uint64_t wp, uint64_t bp) {
+        const uint64_t file_a = 0x0101010101010101ULL;
+        int32_t score = 0;
+        for (int f = 0; f < 8; f++) {
+            uint64_t file = file_a << f;
+            uint64_t adjacent = (f > 0 ? file >> 1 : 0) | (f < 7 ? file << 1 : 0);
+            int w = popcount(wp & file), b = popcount(bp & file);
+            score -= 10 * max(w - 1, 0) - 10 * max(b - 1, 0);
+            if (w && !(wp & adjacent))
+                score -= 10 * w;
+            if (b && !(bp & adjacent))
+                score += 10 * b;
+        }
+        for (uint64_t p = wp; p; p &= p - 1) {
+            int sq = countr_zero(p), r = get_rank(sq), f = get_file(sq);
+            uint64_t span = (file_a << f) | (f > 0 ? file_a << (f - 1) : 0) | (f < 7 ? file_a << (f + 1) : 0);
+            if (!(bp & span & (~0ULL << (8 * r + 8))))
+                score += passed_bonus[r];
+        }
+        for (uint64_t p = bp; p; p &= p - 1) {
+            int sq = countr_zero(p), r = get_rank(sq), f = get_file(sq);
+            uint64_t span = (file_a << f) | (f > 0 ? file_a << (f - 1) : 0) | (f < 7 ? file_a << (f + 1) : 0);
+            if (!(wp & span & ((1ULL << (8 * r)) - 1)))
+                score -= passed_bonus[7 - r];
+        }
+        return score;
+    }
+
+    int32_t pawnScore(uint64_t wp, uint64_t bp) {
+        if (pawn.empty())
+            return pawnStructure(wp, bp);
+        pawn_probes++;
+        auto &e = pawn[((wp * 0x9E3779B97F4A7C15ULL) ^ (bp * 0xC2B2AE3D27D4EB4FULL)) >> (64 - countr_zero(pawn.size()))];
+        if (e.white == wp && e.black == bp) {
+            pawn_hits++;
+            return e.score;
+        }
+        e = {wp, bp, pawnStructure(wp, bp)};
+        return e.score;
+    }
+};
+thread_local EvalTables eval_tables;
 
 // Describes all positions of a board. Should be minimal in data size to utilize cache
 // 128+64 bit, or 24byte
@@ -140,7 +355,8 @@ struct Board {
         uint64_t pieces[2];
     };
     uint64_t position;    // Piece positions as 8x8 bit map, 0 = no piece, 1 = piece. Which one decides the order. Max of 32 bits should be set.
-    uint32_t enpassant_square; // 65 if no square is enpassant
+    uint16_t enpassant_square; // 65 if no square is enpassant
+    int16_t pst_score;         // sum of the piece-square tables, kept up to date by move()
     uint32_t game_flags;
 
     // ------------------ Methods ---------------
@@ -149,6 +365,11 @@ struct Board {
         evals++;
         if (limits.mate_search)
             return 0; // draw pos
+        if (limits.pos_score_enabled) {
+            uint64_t wp, bp;
+            pawns(wp, bp);
+            result = pst_score + eval_tables.pawnScore(wp, bp);
+        }
 
         auto pcs1 = pieces[0];
         auto pcs2 = pieces[1];
@@ -272,6 +493,7 @@ struct Board {
         E_PIECE pc = get_pc(pc_idx, pieces_single);
         const auto move_src = move_from(m);
         const auto move_target = move_to(m);
+        board.pst_score -= pst.score[pc][move_src];
         board.removeFast(move_src, pc_idx);
         if (pc == W_PAWN && get_rank(move_target) == 7) pc = W_QUEEN;
         if (pc == B_PAWN && get_rank(move_target) == 0) pc = B_QUEEN;        
@@ -305,13 +527,16 @@ struct Board {
                 clear_bit32(board.game_flags, B_CK_BIT);
         }
         taken = board.insert(pc, move_to(m));
+        board.pst_score += pst.score[pc][move_target] - pst.score[taken][move_target];
         if (move_target == enpassant_square) { // enpassant take
         	if (pc == W_PAWN) {
             	board.remove(move_target-8);
             	taken = B_PAWN;
+            	board.pst_score -= pst.score[B_PAWN][move_target-8];
         	} else if (pc == B_PAWN) {
             	board.remove(move_target+8);
             	taken = W_PAWN;
+            	board.pst_score -= pst.score[W_PAWN][move_target+8];
         	}
         }
         return board;
@@ -558,13 +783,306 @@ struct Board {
     
     void print(int rep = -1);
     string move2str(Move m);
+    uint64_t hash();
+    void pawns(uint64_t &white, uint64_t &black) {
+        white = black = 0;
+        auto pcs = pieces_single;
+        for (uint64_t pos = position; pos; pos &= pos - 1) {
+            auto pc = uint8_t(pcs) & 0xF;
+            if (pc == W_PAWN)
+                white |= pos & -pos;
+            else if (pc == B_PAWN)
+                black |= pos & -pos;
+            pcs >>= 4;
+        }
+    }
+    int16_t pstScore() { // from scratch, move() keeps pst_score current
+        int16_t result = 0;
+        auto pcs = pieces_single;
+        for (uint64_t pos = position; pos; pos &= pos - 1) {
+            result += pst.score[uint8_t(pcs) & 0xF][countr_zero(pos)];
+            pcs >>= 4;
+        }
+        return result;
+    }
+    uint64_t attacks(bool white);
+    int32_t mobility() { return popcount(attacks(true)) - popcount(attacks(false)); } // white perspective
     void clear() {
-        pieces_single = position = game_flags = 0; enpassant_square = 65;
+        pieces_single = position = game_flags = 0; enpassant_square = 65; pst_score = 0;
     }
 };
 bool operator== (const Board& c1, const Board& c2) { return (c1.position == c2.position) && (c1.pieces_single == c2.pieces_single); };
 
-volatile int *engine_halt; // Goes to MPI window 0 that signals stop / timeout
+// Zobrist keys, side to move is not part of Board and gets xored in by the caller
+struct Zobrist {
+    uint64_t piece[16][64];
+    uint64_t castling[16];
+    uint64_t enpassant[64];
+    uint64_t white_to_move;
+    uint64_t material_only;     // TT entries of searches without the positional score, see f_pvs
+    uint64_t checks_only;       // mate solver entries of its checks only pass, see MateSolver
+
+    Zobrist() {
+        uint64_t s = 0x9E3779B97F4A7C15ULL;
+        auto next = [&s]() { // splitmix64
+            uint64_t z = (s += 0x9E3779B97F4A7C15ULL);
+            z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+            z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+            return z ^ (z >> 31);
+        };
+        for (auto &pc : piece)
+            for (auto &sq : pc)
+                sq = next();
+        for (auto &c : castling)
+            c = next();
+        for (auto &e : enpassant)
+            e = next();
+        white_to_move = next();
+        material_only = next();
+        checks_only = next();
+    }
+} zobrist;
+
+// Computed from scratch, one xor per piece
+uint64_t Board::hash() {
+    uint64_t key = zobrist.castling[game_flags & 0xF];
+    if (enpassant_square < 64)
+        key ^= zobrist.enpassant[enpassant_square];
+    auto pcs = pieces_single;
+    for (uint64_t pos = position; pos; pos &= pos - 1) {
+        key ^= zobrist.piece[uint8_t(pcs) & 0xF][countr_zero(pos)];
+        pcs >>= 4;
+    }
+    return key;
+}
+
+uint64_t hashKey(Board &b, bool white) { return b.hash() ^ (white ? zobrist.white_to_move : 0); }
+
+// Attack sets per square. Sliders use rays, cut at the first blocker.
+enum E_RAY { RAY_N, RAY_NE, RAY_E, RAY_SE, RAY_S, RAY_SW, RAY_W, RAY_NW };
+struct AttackTables {
+    uint64_t knight[64], king[64], pawn[2][64]; // pawn[1] white
+    uint64_t ray[8][64];
+
+    AttackTables() {
+        const int dr[8] = {1, 1, 0, -1, -1, -1, 0, 1}, dc[8] = {0, 1, 1, 1, 0, -1, -1, -1};
+        auto on = [](int r, int c) { return r >= 0 && r < 8 && c >= 0 && c < 8; };
+        for (int sq = 0; sq < 64; sq++) {
+            int r = get_rank(sq), c = get_file(sq);
+            knight[sq] = king[sq] = pawn[0][sq] = pawn[1][sq] = 0;
+            for (auto [kr, kc] : {pair{1, 2}, {2, 1}, {-1, 2}, {-2, 1}, {1, -2}, {2, -1}, {-1, -2}, {-2, -1}})
+                if (on(r + kr, c + kc))
+                    set_bit(knight[sq], get_bitpos(r + kr, c + kc));
+            for (int d = 0; d < 8; d++) {
+                if (on(r + dr[d], c + dc[d]))
+                    set_bit(king[sq], get_bitpos(r + dr[d], c + dc[d]));
+                ray[d][sq] = 0;
+                for (int l = 1; on(r + l * dr[d], c + l * dc[d]); l++)
+                    set_bit(ray[d][sq], get_bitpos(r + l * dr[d], c + l * dc[d]));
+            }
+            for (int dc_ : {-1, 1}) {
+                if (on(r + 1, c + dc_))
+                    set_bit(pawn[1][sq], get_bitpos(r + 1, c + dc_));
+                if (on(r - 1, c + dc_))
+                    set_bit(pawn[0][sq], get_bitpos(r - 1, c + dc_));
+            }
+        }
+    }
+
+    uint64_t slide(int d, int sq, uint64_t occupied) {
+        uint64_t a = ray[d][sq];
+        uint64_t blockers = a & occupied;
+        if (blockers) // N, NE, E and NW point to higher squares
+            a ^= ray[d][d <= RAY_E || d == RAY_NW ? countr_zero(blockers) : 63 - countl_zero(blockers)];
+        return a;
+    }
+} attack_tables;
+
+// Squares one side attacks or defends. No legality, castling or en passant, a cheap mobility measure.
+uint64_t Board::attacks(bool white) {
+    uint64_t result = 0;
+    auto pcs = pieces_single;
+    for (uint64_t pos = position; pos; pos &= pos - 1) {
+        auto pc = uint8_t(pcs) & 0xF;
+        pcs >>= 4;
+        if ((pc > 7) == white)
+            continue;
+        int sq = countr_zero(pos);
+        switch (pc) {
+        case W_PAWN: result |= attack_tables.pawn[1][sq]; break;
+        case B_PAWN: result |= attack_tables.pawn[0][sq]; break;
+        case W_KNIGHT: case B_KNIGHT: result |= attack_tables.knight[sq]; break;
+        case W_KING: case B_KING: result |= attack_tables.king[sq]; break;
+        case W_QUEEN: case B_QUEEN:
+            for (int d = 0; d < 8; d++)
+                result |= attack_tables.slide(d, sq, position);
+            break;
+        case W_ROOK: case B_ROOK:
+            for (int d = RAY_N; d <= RAY_W; d += 2)
+                result |= attack_tables.slide(d, sq, position);
+            break;
+        case W_BISHOP: case B_BISHOP:
+            for (int d = RAY_NE; d <= RAY_NW; d += 2)
+                result |= attack_tables.slide(d, sq, position);
+            break;
+        }
+    }
+    return result;
+}
+
+#define REP_MAX 128 // game positions kept for repetition checks, covers the 50 move window
+
+// Keys of the positions since the last capture or pawn move: the game part comes with the job,
+// the search part is pushed and popped by f_pvs.
+struct RepHistory {
+    uint64_t keys[REP_MAX + MAX_DEPTH];
+    int n = 0;
+    int floor = 0; // first index a position can repeat, moves past it are irreversible
+
+    void set(const uint64_t *k, int len) {
+        len = min(len, REP_MAX);
+        copy(k, k + len, keys);
+        n = len;
+        floor = 0;
+    }
+
+    // same side to move lies an even distance back, and a position needs at least 4 plies to repeat
+    bool repeated(uint64_t key) {
+        for (int i = n - 4; i >= floor; i -= 2)
+            if (keys[i] == key)
+                return true;
+        return false;
+    }
+};
+thread_local RepHistory rep_history;
+
+#ifdef ENG_HASH_TABLES
+#define TT_BITS 20 // 16 byte entries, 16MB per worker
+
+enum E_TT_BOUND { TT_EXACT = 1, TT_LOWER = 2, TT_UPPER = 3 };
+
+struct TTEntry {
+    uint32_t key;          // upper half of the zobrist key, the lower bits are the index
+    int32_t score;
+    Move move;
+    uint8_t depth;
+    uint8_t bound;         // E_TT_BOUND, 0 = empty
+    uint8_t result_depth;  // depth - EvalResult.depth
+    uint8_t gen;
+    uint16_t era;          // of SearchTables::clear, entries of an older one are empty
+};
+static_assert(sizeof(TTEntry) == 16, "TTEntry should be 16 bytes");
+
+// Search state a worker keeps between jobs. Because it survives the move actually played, the next search
+// starts with the subtree of that move already in the table, see the affinity routing in Game.
+struct SearchTables {
+    vector<TTEntry> tt;
+    uint64_t mask = 0;
+    uint8_t gen = 0;
+    uint16_t era = 0;
+    Move killers[MAX_DEPTH][2];
+    int32_t history[64][64];
+
+    void clear() {
+        if (tt.empty()) {
+            tt.resize(1ULL << TT_BITS);
+            mask = tt.size() - 1;
+        }
+        if (++era == 0) { // the table is only swept when the era wraps, clearing per job stays cheap
+            fill(tt.begin(), tt.end(), TTEntry{});
+            era = 1;
+        }
+        memset(killers, 0, sizeof(killers));
+        memset(history, 0, sizeof(history));
+    }
+
+    void newSearch() { // older entries become replaceable, ordering hints fade
+        gen++;
+        memset(killers, 0, sizeof(killers));
+        for (auto &from : history)
+            for (auto &h : from)
+                h /= 2;
+    }
+
+    TTEntry *probe(uint64_t key) {
+        TTEntry &e = tt[key & mask];
+        return (e.bound && e.era == era && e.key == uint32_t(key >> 32)) ? &e : nullptr;
+    }
+
+    void store(uint64_t key, int depth, int score, Move move, int bound, int result_depth) {
+        TTEntry &e = tt[key & mask];
+        if (e.bound && e.era == era && e.gen == gen && e.depth > depth && e.key != uint32_t(key >> 32))
+            return; // keep the deeper entry of this search
+        e = {uint32_t(key >> 32), score, move, uint8_t(depth), uint8_t(bound), uint8_t(depth - result_depth), gen, era};
+    }
+
+    // Captures stay in front as generated, then killers, then quiet moves by history, tt move first of all
+    void order(Board &x, bool white, MoveArray moves, uint16_t m, uint64_t opponent, Move tt_move, int depth) {
+        uint16_t front = 0;
+        while (front < m && has_bit(opponent, move_to(moves[front])))
+            front++;
+        for (auto k : killers[depth])
+            for (uint16_t i = front; i < m && k; i++)
+                if (moves[i] == k) {
+                    rotate(moves + front, moves + i, moves + i + 1);
+                    front++;
+                    break;
+                }
+        if (depth >= 3)
+            for (uint16_t i = front + 1; i < m; i++) // insertion sort, short lists
+                for (uint16_t j = i; j > front && history[move_from(moves[j])][move_to(moves[j])] > history[move_from(moves[j-1])][move_to(moves[j-1])]; j--)
+                    swap(moves[j], moves[j-1]);
+        if (tt_move == 0 || tt_move == moves[0] || x.getPiece(move_to(moves[0])) == (white ? B_KING : W_KING))
+            return; // king capture must stay first
+        for (uint16_t i = 1; i < m; i++)
+            if (moves[i] == tt_move) {
+                rotate(moves, moves + i, moves + i + 1);
+                break;
+            }
+    }
+
+    void cut(Move move, int depth) { // quiet move caused a beta cut
+        if (killers[depth][0] != move) {
+            killers[depth][1] = killers[depth][0];
+            killers[depth][0] = move;
+        }
+        history[move_from(move)][move_to(move)] += depth * depth;
+    }
+};
+thread_local SearchTables tables;
+#endif
+
+int engine_no_halt = 0;
+thread_local volatile int *engine_halt = &engine_no_halt; // Goes to MPI window 0 or the JobSlot that signals stop / timeout
+// A stop names the search generation it is for (HALT_TOKEN(epoch)), so a late one can not stop the next search of
+// another game on the same worker. HALT_ALL stops whatever runs.
+#define HALT_TOKEN(epoch) (0x100 | (epoch))
+#define HALT_ALL -1
+thread_local int halt_token = 0; // of the running job
+
+static inline bool haltRequested() {
+    int h = *engine_halt;
+    return h && (h == halt_token || h == HALT_ALL);
+}
+
+// Limits a whole position job sets for itself, 0 = none. The clock is read every 256 polls only.
+thread_local TimePoint search_deadline = 0;
+thread_local uint64_t search_node_limit = 0;
+thread_local bool search_limit_hit = false;
+thread_local uint32_t search_polls = 0;
+
+static inline bool searchHalted() {
+    if (haltRequested() || search_limit_hit)
+        return true;
+    if ((search_deadline || search_node_limit) && (++search_polls & 255) == 0)
+        search_limit_hit = (search_deadline && now() >= search_deadline) || (search_node_limit && evals >= search_node_limit);
+    return search_limit_hit;
+}
+
+#ifdef ENG_NNUE
+#include "nnue.hpp"
+#endif
+#include "bitbase.hpp"
 
 EvalResult f_negamax(int depth, Board &x, int alpha, int beta, bool white, int16_t white_mc, int16_t black_mc) {
     EvalResult result{};
@@ -582,12 +1100,8 @@ EvalResult f_negamax(int depth, Board &x, int alpha, int beta, bool white, int16
     E_PIECE taken = P_EMPTY;
     result.score = INT32_MIN + 1;
     result.move = 0;
-    // Count moves that threaten an opponent
-    uint16_t threats = 0;
-    if (limits.pos_score_enabled)
-        for (int i = 0; i < m; i ++) 
-            if (has_bit(opponent, move_to(moves[i])))
-                threats++;
+    // Squares the side to move attacks, the leaves score it against the opponent's
+    int16_t threats = limits.pos_score_enabled ? popcount(x.attacks(white)) : 0;
          
     for (int i = 0; i < m; i ++) {
         Board new_board = x.move(moves[i], taken);
@@ -620,7 +1134,7 @@ EvalResult f_negamax(int depth, Board &x, int alpha, int beta, bool white, int16
             }
             #endif
         }
-        if (*engine_halt)
+        if (searchHalted())
         	return result;
     }
 
@@ -640,31 +1154,102 @@ EvalResult f_negamax(int depth, Board &x, int alpha, int beta, bool white, int16
     return result;
 }
 
+struct RepPush {
+    RepPush(uint64_t key) { rep_history.keys[rep_history.n++] = key; }
+    ~RepPush() { rep_history.n--; }
+};
+
 // https://en.wikipedia.org/wiki/Principal_variation_search
+// Leaf eval from white's view, through the eval cache if there is one. Worth it in front of the network,
+// the material eval is cheaper than the key.
+int32_t leafEval(Board &x) {
+    if (limits.mate_search) {
+        evals++;
+        return 0;
+    }
+    auto &et = eval_tables;
+    uint64_t key = 0;
+    int32_t score;
+    if (!et.eval.empty()) {
+        key = x.hash() ^ (limits.pos_score_enabled ? zobrist.white_to_move : 0); // any constant, the two modes differ
+        if (et.probeEval(key, score)) {
+            evals++;
+            return score;
+        }
+    }
+#ifdef ENG_NNUE
+    if (nnue.net) {
+        evals++;
+        score = nnue.evaluate(nnue_acc[0]);
+    } else
+#endif
+    score = x.eval();
+    if (!et.eval.empty())
+        et.storeEval(key, score);
+    return score;
+}
+
 EvalResult f_pvs(int depth, Board &x, int alpha, int beta, bool white, int16_t white_mc, int16_t black_mc) {
     EvalResult result{};
+#ifdef ENG_STATS
+    search_stats.nodes[clamp(stats_root_depth - depth, 0, MAX_DEPTH)]++;
+#endif
     if (depth == 0) {
-        result.score = x.eval();
+        result.score = leafEval(x);
         if (limits.pos_score_enabled)
             result.score += white_mc - black_mc;  // Enabling drastically reduces possible branch cuts
         if (!white)
             result.score = -result.score;
         return result;
     }
+    uint64_t key = hashKey(x, white);
+    if (rep_history.repeated(key)) { // draw, the line leads back
+        result.score = 0;
+        result.depth = depth;
+        result.lot[depth] = 0xFFDD;
+        return result;
+    }
+    if (popcount(x.position) <= 3 && bitbases.probe(x, white, depth, result.score)) { // known ending, the line stops here
+        evals++;
+        result.depth = depth;
+        result.lot[depth] = 0xFFCC;
+        return result;
+    }
+    RepPush rep_push(key);
     uint64_t opponent;
     MoveArray moves;
     uint16_t m = x.moves(white, moves, &opponent);
     E_PIECE taken = P_EMPTY;
     result.score = INT32_MIN + 1;
     result.move = 0;
-    // Count moves that threaten an opponent
-    int16_t &threats = white ? white_mc : black_mc;
+#ifdef ENG_HASH_TABLES
+    const int alpha_orig = alpha;
+    // the two score modes must not share entries, the tables outlive a job and serve every game on the rank
+    const uint64_t tt_key = key ^ (limits.pos_score_enabled ? 0 : zobrist.material_only);
+    if (depth >= 2) {
+        Move tt_move = 0;
+        if (TTEntry *e = tables.probe(tt_key)) {
+            bool mate = abs(e->score) >= INT32_MAX / 4; // mate scores depend on the remaining depth
+            // cut in null window nodes only, pv nodes need their line of thought
+            if (beta - alpha == 1 && (mate ? e->depth == depth : e->depth >= depth) &&
+                (e->bound == TT_EXACT || (e->bound == TT_LOWER && e->score >= beta) || (e->bound == TT_UPPER && e->score <= alpha))) {
+                result.score = e->score;
+                result.lot[depth] = result.move = e->move;
+                result.depth = depth - e->result_depth;
+                return result;
+            }
+            tt_move = e->move;
+        }
+        if (m > 1)
+            tables.order(x, white, moves, m, opponent, tt_move, depth);
+    }
+#endif
+    // Squares the side to move attacks, the leaves score it against the opponent's
     if (limits.pos_score_enabled)
-        for (int i = 0; i < m; i ++) 
-            if (has_bit(opponent, move_to(moves[i])))
-                threats++;
+        (white ? white_mc : black_mc) = popcount(x.attacks(white));
          
     for (int i = 0; i < m; i ++) {
+        E_PIECE mover = depth >= 2 ? x.getPiece(move_from(moves[i])) : P_EMPTY;
         Board new_board = x.move(moves[i], taken);
 
         if (taken == W_KING || taken == B_KING) {
@@ -679,15 +1264,27 @@ EvalResult f_pvs(int depth, Board &x, int alpha, int beta, bool white, int16_t w
             evals++;
             return result;
         }
+        int rep_floor = rep_history.floor;
+        if (taken != P_EMPTY || mover == W_PAWN || mover == B_PAWN) // nothing before this move can come back
+            rep_history.floor = rep_history.n;
+#ifdef ENG_NNUE
+        if (nnue.net)
+            nnue.update(nnue_acc[depth - 1], nnue_acc[depth], x, new_board, moves[i]);
+#endif
         EvalResult eval_pos;
         if (i == 0) {
             eval_pos = f_pvs(depth - 1, new_board, -beta, -alpha, !white, white_mc, black_mc);
         } else {
             eval_pos = f_pvs(depth - 1, new_board, -alpha - 1, -alpha, !white, white_mc, black_mc);
             int score = -eval_pos.score;
+#ifdef ENG_STATS
+            search_stats.null_windows++;
+            search_stats.researches += alpha < score && score < beta;
+#endif
             if (alpha < score && score < beta)
                 eval_pos = f_pvs(depth - 1, new_board, -beta, -alpha, !white, white_mc, black_mc);
         }
+        rep_history.floor = rep_floor;
         if (-eval_pos.score > result.score) {
             result.score = -eval_pos.score;
             result.depth = eval_pos.depth;
@@ -698,11 +1295,23 @@ EvalResult f_pvs(int depth, Board &x, int alpha, int beta, bool white, int16_t w
             alpha = max(alpha, result.score);
             if (alpha >= (beta - ENG_POS_SCORE_ACCURACY)) {
                 ab_cuts++;
+#ifdef ENG_STATS
+                search_stats.cuts++;
+                search_stats.first_cuts += i == 0;
+                search_stats.cut_index += i;
+#endif
+#ifdef ENG_HASH_TABLES
+                if (depth >= 2 && !searchHalted()) {
+                    if (taken == P_EMPTY)
+                        tables.cut(moves[i], depth);
+                    tables.store(tt_key, depth, result.score, result.move, TT_LOWER, result.depth);
+                }
+#endif
                 return result; // (* cut-off *)
             }
             #endif
         }
-        if (*engine_halt)
+        if (searchHalted())
             return result;
     }
 
@@ -719,8 +1328,67 @@ EvalResult f_pvs(int depth, Board &x, int alpha, int beta, bool white, int16_t w
                 result.lot[j] = 0;
         }
     }
+#ifdef ENG_HASH_TABLES
+    if (depth >= 2 && !searchHalted())
+        tables.store(tt_key, depth, result.score, result.move, result.score <= alpha_orig ? TT_UPPER : TT_EXACT, result.depth);
+#endif
     return result;
 }
+
+// Legal root moves of a whole position job, in mate.hpp with the legal move generator of the mate solver
+int rootMoves(Board &x, bool white, MoveArray moves);
+
+// A whole position as one job: deepens until depth, the job's limits or a mate and keeps the last
+// finished iteration, its move sits at lot[iteration depth] (RootSearch reads the depth from there). The root loop is here and not in f_pvs so a root
+// in the endgame tables still gets a move, a legal one even if halted. The caller makes sure there is one. Depth 1 always counts,
+// a cut one still has a move.
+EvalResult f_root(int depth, Board &x, bool white) {
+    MoveArray moves;
+    int m = rootMoves(x, white, moves);
+    EvalResult best{};
+    RepPush rep_push(hashKey(x, white));
+    for (int d = 1; d <= depth; d++) {
+        EvalResult iter{};
+        iter.score = INT32_MIN + 1;
+        int alpha = INT32_MIN + 1;
+#ifdef ENG_STATS
+        stats_root_depth = d;
+        search_stats.nodes[0]++;
+#endif
+        for (int i = 0; i < m; i++) {
+            E_PIECE taken;
+            Board child = x.move(moves[i], taken);
+#ifdef ENG_NNUE
+            if (nnue.net)
+                nnue.refresh(nnue_acc[d - 1], child);
+#endif
+            EvalResult r = i == 0 ? f_pvs(d - 1, child, INT32_MIN + 1, INT32_MAX, !white, -1, 0)
+                                  : f_pvs(d - 1, child, -alpha - 1, -alpha, !white, -1, 0);
+#ifdef ENG_STATS
+            search_stats.null_windows += i > 0;
+            search_stats.researches += i > 0 && -r.score > alpha && !searchHalted();
+#endif
+            if (i > 0 && -r.score > alpha && !searchHalted()) // null window first, the full one if it beats the best
+                r = f_pvs(d - 1, child, INT32_MIN + 1, -alpha, !white, -1, 0);
+            if (-r.score > iter.score) {
+                iter = r;
+                iter.score = -r.score;
+                iter.lot[d] = iter.move = moves[i];
+                alpha = max(alpha, iter.score);
+            }
+            if (searchHalted())
+                break;
+        }
+        if (searchHalted() && d > 1)
+            break;
+        best = iter;
+        auto it = find(moves, moves + m, best.move); // best first in the next iteration
+        rotate(moves, it, it + 1);
+        if (abs(best.score) >= INT32_MAX / 4)
+            break;
+    }
+    return best;
+}
 /*
 function pvs(node, depth, α, β, color) is
     if depth = 0 or node is a terminal node then
@@ -10,7 +10,7 @@ struct CruncherResult_s {
 struct CruncherInstruction_s {
 	Board position;
 	bool white_to_move;
-	bool mate_search;
+	int mate_search;		// go mate N, 0 = normal search
 	bool pos_score_enabled;
 	int depth;
 };
@@ -24,6 +24,8 @@ struct Game {
 	vector<uint16_t> move_history;  // WBWBWBWB... moves if first_white == true, otherwise BWBWBWBWBW...
 	vector<Board> 	 board_history;	// same here
 	vector<EvalResult> eval_history;// and here
+	vector<uint64_t> key_history;	// position keys since the last capture or pawn move, current last
+	string start_fen;				// FEN the game was set up with, empty if set up from a board
 
 	Game(const string StartFEN = "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1") {
   		setFEN(StartFEN);
@@ -34,9 +36,11 @@ struct Game {
 		initial = current = init;
 		white_to_move = first_white = wtm;
 		last_search_ms = last_search_start = 0;
+		key_history = {hashKey(current, white_to_move)};
 	}
 
 	void setFEN(const string fen) {
+		start_fen = fen;
 		move_history.clear(); 
 		board_history.clear();
 		eval_history.clear();
@@ -97,7 +101,7 @@ struct Game {
 
 		// 2. Active color
 		ss >> token;
-		white_to_move = (token == 'w');
+		white_to_move = first_white = (token == 'w');
 		ss >> token;
 
 		// 3. Castling availability. Compatible with 3 standards: Normal FEN standard,
@@ -119,8 +123,26 @@ struct Game {
 		   initial.enpassant_square = (col - 'a') + (row - '1') * 8;
 		}  else
 		   initial.enpassant_square = 65;
+		initial.pst_score = initial.pstScore();
 		current = initial;
+		key_history = {hashKey(current, white_to_move)};
 	}
+
+	// UCI sends the whole game with every position command. Usually it extends what we have by a move
+	// or two, so only those are played. Moves are checked against the pseudo legal list only,
+	// an unknown move ends the list like before.
+	void setPosition(const string &fen, const vector<Move> &moves) {
+		if (fen != start_fen || moves.size() < move_history.size() || !equal(move_history.begin(), move_history.end(), moves.begin()))
+			setFEN(fen);
+		MoveArray legal;
+		for (size_t i = move_history.size(); i < moves.size(); i++) {
+			uint16_t n = current.moves(white_to_move, legal);
+			if (find(legal, legal + n, moves[i]) == legal + n)
+				break;
+			execMove(moves[i]);
+		}
+	}
+
 	void execMove(Move m) {
 		EvalResult er{};
 		er.move = m;
@@ -133,49 +155,111 @@ struct Game {
 			current = initial;
 		}
 		E_PIECE took;
+		E_PIECE mover = current.getPiece(move_from(er.move));
 		move_history.push_back(er.move);
 		eval_history.push_back(er);
 		current = current.move(er.move, took);
 		board_history.push_back(current);
 		white_to_move = !white_to_move;
+		if (took != P_EMPTY || mover == W_PAWN || mover == B_PAWN)
+			key_history.clear();
+		key_history.push_back(hashKey(current, white_to_move));
+	}
+
+	// Legal moves and terminal status of current, rebuilt when current or the side to move changed
+	struct PositionInfo {
+		Board board;
+		bool white;
+		bool valid = false;
+		bool mate, stale;
+		uint16_t n;
+		MoveArray moves;
+	} position_info;
+
+	PositionInfo &info() {
+		auto &pi = position_info;
+		if (pi.valid && pi.white == white_to_move && !memcmp(&pi.board, &current, sizeof(Board)))
+			return pi;
+		pi.board = current;
+		pi.white = white_to_move;
+		pi.valid = true;
+		pi.n = rootMoves(current, white_to_move, pi.moves);
+		pi.mate = pi.n == 0 && current.isCheck(white_to_move);
+		pi.stale = pi.n == 0 && !pi.mate;
+		return pi;
 	}
 
 	// comfort of vector only possible in higher level game state where speed does not matter anymore
 	vector<Move> getValidMoves() {
-	    MoveArray moves;
-	    uint16_t m = current.moves(white_to_move, moves);
-	    current.removeInvalid(white_to_move, m, moves);
-		vector<Move> result;
-		for (int i = 0; i < m; i++)
-			result.push_back(moves[i]);
-		return result;
+		auto &pi = info();
+		return vector<Move>(pi.moves, pi.moves + pi.n);
 	}
 
 	bool isValidMove(Move move) {
-		auto moves = getValidMoves();
-		return find(moves.begin(), moves.end(), move) != moves.end();
+		auto &pi = info();
+		return find(pi.moves, pi.moves + pi.n, move) != pi.moves + pi.n;
 	}
 
 	bool isMate() {
-		if (!getValidMoves().empty())
-			return false;
-		return !isStaleMate();
+		return info().mate;
 	}
 
 	bool isStaleMate() {
-		if (!getValidMoves().empty())
-			return false;
-		white_to_move = !white_to_move;
-		auto m = getValidMoves();
-		white_to_move = !white_to_move;
-		E_PIECE take;
-        E_PIECE own_king = white_to_move ? W_KING : B_KING;
-        for (auto move : m) {
-        	current.move(move, take);
-        	if (take == own_king)
-        		return false;
-        }
-        return true;
+		return info().stale;
+	}
+
+	static bool isLegal(Board &b, bool white, Move move) {
+		MoveArray moves;
+		int n = rootMoves(b, white, moves);
+		return find(moves, moves + n, move) != moves + n;
+	}
+
+	// Standard algebraic notation of a legal move, for EPD and PGN. Promotions are always to a queen here.
+	static string san(Board &b, bool white, Move m) {
+		static const char letter[16] = {0, 0, 'K', 'Q', 'R', 'B', 'N', 0, 'R', 'B', 'N', 'K', 'Q', 0, 0, 0};
+		int from = move_from(m), to = move_to(m);
+		E_PIECE pc = b.getPiece(from);
+		bool pawn = pc == W_PAWN || pc == B_PAWN;
+		bool capture = b.getPiece(to) != P_EMPTY || (pawn && to == b.enpassant_square);
+		Move legal[128];
+		Board boards[128];
+		int n = MateSolver::legal(b, white, legal, boards);
+		string r;
+		if (!pawn && letter[pc] == 'K' && abs(get_file(from) - get_file(to)) == 2)
+			r = get_file(to) > get_file(from) ? "O-O" : "O-O-O";
+		else {
+			if (pawn) {
+				if (capture)
+					r += char('a' + get_file(from));
+			} else {
+				r += letter[pc];
+				bool clash = false, same_file = false, same_rank = false;
+				for (int i = 0; i < n; i++)
+					if (legal[i] != m && move_to(legal[i]) == to && b.getPiece(move_from(legal[i])) == pc) {
+						clash = true;
+						same_file |= get_file(move_from(legal[i])) == get_file(from);
+						same_rank |= get_rank(move_from(legal[i])) == get_rank(from);
+					}
+				if (clash && (!same_file || same_rank))
+					r += char('a' + get_file(from));
+				if (clash && same_file)
+					r += char('1' + get_rank(from));
+			}
+			if (capture)
+				r += 'x';
+			r += char('a' + get_file(to));
+			r += char('1' + get_rank(to));
+			if (pawn && (get_rank(to) == 0 || get_rank(to) == 7))
+				r += "=Q";
+		}
+		for (int i = 0; i < n; i++)
+			if (legal[i] == m) {
+				Board after = boards[i];
+				if (MateSolver::inCheck(after, !white))
+					r += MateSolver::legal(after, !white, legal, boards) ? "+" : "#";
+				break;
+			}
+		return r;
 	}
 
 	// returns index in er or -1 if er is empty
@@ -189,26 +273,17 @@ struct Game {
 			return er[0];
 		}
 
-		// give castle bonus & penalize check for castling. Easier to penalize than to remove from valid moves
+		// give castle bonus & penalize castling out of or through check. Easier to penalize than to remove from valid moves
+		uint64_t attacked = current.attacks(!white_to_move);
+		const uint64_t w_o_o_path = 0x70, w_o_o_o_path = 0x1C; // e1-g1, c1-e1
 		for (auto &e : er) {
-			Board c = current;
-			if (e.move == w_o_o) {
-				c.insert(W_KING, get_bitpos(0, 5));
-				c.insert(W_KING, get_bitpos(0, 6));
-				e.score += c.isCheck(true) ? -value[W_KING] : 10;
-			} else if (e.move == w_o_o_o) {
-				c.insert(W_KING, get_bitpos(0, 2));
-				c.insert(W_KING, get_bitpos(0, 3));
-				e.score += c.isCheck(true) ? -value[W_KING] : 10;
-			} else if (e.move == b_o_o) {
-				c.insert(B_KING, get_bitpos(7, 5));
-				c.insert(B_KING, get_bitpos(7, 6));
-				e.score += c.isCheck(false) ? -value[W_KING] : 10;
-			} else if (e.move == b_o_o_o) {
-				c.insert(B_KING, get_bitpos(7, 2));
-				c.insert(B_KING, get_bitpos(7, 3));
-				e.score += c.isCheck(false) ? -value[W_KING] : 10;
-			}
+			uint64_t path = 0;
+			if (e.move == w_o_o) path = w_o_o_path;
+			else if (e.move == w_o_o_o) path = w_o_o_o_path;
+			else if (e.move == b_o_o) path = w_o_o_path << 56;
+			else if (e.move == b_o_o_o) path = w_o_o_o_path << 56;
+			if (path)
+				e.score += (attacked & path) ? -value[W_KING] : 10;
 		}
 
 		// give pawn move bonus
@@ -229,24 +304,17 @@ struct Game {
 		*/
 		if (!limits.pos_score_enabled) { // if only material score, add at least pos score for available moves and re-sort 
 			for (auto &e : er) {
-				uint16_t dummy[128];E_PIECE dummy_;
-				Board c = current.move(e.move, dummy_);
-				uint16_t n_wtm = c.moves(white_to_move, dummy);
-				c.removeInvalid(white_to_move, n_wtm, dummy);
-				e.score += n_wtm;
-				n_wtm = c.moves(!white_to_move, dummy);
-				c.removeInvalid(!white_to_move, n_wtm, dummy);
-				e.score -= n_wtm;
+				E_PIECE took;
+				int32_t mobility = current.move(e.move, took).mobility();
+				e.score += white_to_move ? mobility : -mobility;
 				// favor takes if score is in front?
 			}
 			sort(er.begin(), er.end(), greater<EvalResult>());
 		}
-		// Try to avoid draw by taking less optimal moves, down to ENG_MOVE_DEVIATION
-		int desired_i = checkRepetition();
-		cout << "info moveselect num " << er.size() << " rep " << desired_i << endl;
+		cout << "info moveselect num " << er.size() << endl;
 		for (auto e : er)
 			cout << current.move2str(e.move) << " : " << e.score << endl;
-		return er[min(desired_i, int(er.size()-1))];
+		return er[0];
 	}
 
 	// Prints useful stuff.
@@ -258,14 +326,17 @@ struct Game {
 	    ExtendedEvalResult results;
 	    results.resize(m);
 	    cout << "OMP PAR search with up to " << m << " threads W "<< white_to_move << endl;
-		#pragma omp parallel for shared(results) schedule(dynamic,1)
+	    uint64_t total_evals = 0; // stats are per thread
+		#pragma omp parallel for shared(results) schedule(dynamic,1) reduction(+:total_evals)
 	    for (uint i = 0; i < m; i ++) {
 		    auto t11 = steady_clock::now();
+		    uint64_t evals_before = evals;
 	        E_PIECE took;
 	        Board new_board = current.move(moves[i], get_pcidx(current.position, move_from(moves[i])), took);
 	        results[i] = f_negamax(depth - 1, new_board, INT32_MIN + 1, INT32_MAX, !white_to_move, -1, 0);
 	        results[i].score = -results[i].score;
 	        results[i].move = results[i].lot[depth] = moves[i];
+	        total_evals += evals - evals_before;
 	        fixLOT(results[i]);
 		    auto t22 = steady_clock::now();
 		    /* Getting number of milliseconds as an integer. */
@@ -276,6 +347,7 @@ struct Game {
 	    auto t2 = steady_clock::now();
 	    /* Getting number of milliseconds as an integer. */
 	    auto duration_ = duration<double,milli>(t2 - t1);
+	    evals = total_evals;
 	    double speed = (double)evals / duration_.count();
 	    if (results.size() == 0)
 	    	cout << move_history.size() << ": " << (white_to_move?"W ":"B ") << " NO MOVE LEFT!\n";
@@ -292,18 +364,106 @@ struct Game {
 		CruncherInstruction_s instruction;
 		CruncherResult_s result;
 		int rank;
-		MPI_Request mpi_request;
+		int affinity;			// rank that holds the subtree from an earlier search, 0 if none
+		uint16_t id;
+		bool done;
+		uint64_t cost;			// predicted subtree size, queue is dispatched largest first
+		TimePoint dispatched;
 	};
 	list<MoveSearchRequest_s> searchq;
+	uint8_t search_epoch = 0;
+	uint32_t search_history = 0;	// serial of search_keys at the cluster
+	vector<uint64_t> search_keys;	// key_history when the search started
+	uint64_t busy_ms_total = 0, jobs_total = 0;	// all searches, the server's fair share
+	bool reporting = false;			// for a GUI: info lines while the root moves come in, bestmove once it is decided
+
+	// Cost model for root jobs. Node counts of the last search are kept per resulting board, the expected
+	// PV move is remembered for the same root (re-search) and for the root two plies down the PV (next move).
+	struct JobCost_s {
+		Board position;
+		uint64_t evals;
+	};
+	vector<JobCost_s> job_costs, job_costs_next;
+	int job_costs_depth = 0;
+	int last_search_depth = 0;
+	bool job_costs_pending = false;
+	struct PVHint_s {
+		Board root;
+		bool white_to_move;
+		Move move;
+	} pv_hint[2] = {};
+	uint64_t job_busy_ms = 0;	// summed worker time of the current search
+
+	// Which rank searched which root job. Workers keep their tables, so a job goes back to the rank
+	// that searched the same position or, after a move, the position the game went through.
+	unordered_map<uint64_t, int> subtree_owner;
+
+	int subtreeOwner(Board &position, bool wtm) {
+		auto it = subtree_owner.find(hashKey(position, wtm));
+		if (it != subtree_owner.end())
+			return it->second;
+		// the root went through an earlier job position: our last move, then the one before
+		for (int back = 1; back < 4 && back < int(board_history.size()); back++) {
+			Board &b = board_history[board_history.size() - 1 - back];
+			it = subtree_owner.find(hashKey(b, back % 2 ? !white_to_move : white_to_move));
+			if (it != subtree_owner.end() && it->second < cpu_count)
+				return it->second;
+		}
+		return 0;
+	}
 
+	uint64_t estimateCost(const Board &position, int depth) {
+		if (!job_costs.empty()) {
+			for (const auto &jc : job_costs)
+				if (jc.position == position) {
+					uint64_t cost = jc.evals;
+					for (int d = job_costs_depth; d < depth; d++)
+						cost *= 6; // rough effective branching factor of the pvs tree
+					for (int d = depth; d < job_costs_depth; d++)
+						cost /= 6;
+					return cost + 1;
+				}
+		}
+		// no history, number of replies is a fair guess for the subtree width
+		MoveArray dummy;
+		Board c = position;
+		return c.moves(!white_to_move, dummy);
+	}
+
+	Move expectedPVMove() {
+		for (const auto &h : pv_hint)
+			if (h.move != 0 && h.white_to_move == white_to_move && h.root == current)
+				return h.move;
+		return 0;
+	}
+
+	// Remember node counts and PV of a finished search for the next job ordering
+	void recordJobCosts(int depth) {
+		job_costs.swap(job_costs_next);
+		job_costs_next.clear();
+		job_costs_depth = depth;
+		auto best = *max_element(last_search_result.begin(), last_search_result.end());
+		pv_hint[0] = {current, white_to_move, best.move};
+		pv_hint[1] = {};
+		Move reply = depth > 1 ? best.lot[depth - 1] : 0;
+		Move next = depth > 2 ? best.lot[depth - 2] : 0;
+		if (reply == 0 || reply >= 0xFFCC || next == 0 || next >= 0xFFCC)
+			return;
+		E_PIECE took;
+		Board after_reply = current.move(best.move, took).move(reply, took);
+		pv_hint[1] = {after_reply, white_to_move, next};
+	}
+
+	// Ranks are shared with other games, only the jobs of this search are stopped and waited for
 	void stopSearchMPI(bool call_process = false) {
-		int x = 1;
-		for (const auto& ms : searchq)
-			if (ms.rank > 0)
-    			auto r = MPI_Put((void *)&x, 1, MPI_INT, ms.rank, 0, 1, MPI_INT, eng_halt_win);
-		for (auto& ms : searchq)
-			if (ms.rank > 0)
-		    	MPI_Wait(&ms.mpi_request, MPI_STATUSES_IGNORE);
+		vector<bool> halted(cpu_count);
+		for (auto &sr : searchq)
+			if (sr.rank > 0 && !sr.done && !halted[sr.rank]) {
+				cluster.halt(sr.rank, search_epoch);
+				halted[sr.rank] = true;
+			}
+		while (receiveResults())
+			sleep_us(50);
 		// remove all pending from Q#
 		auto it = searchq.begin();
 		while (it != searchq.end()) {
@@ -333,6 +493,14 @@ struct Game {
 	void startSearchMPI(vector<Move> moves, int depth) {
 	    auto m = moves.size();
 	    last_search_result.resize(0);
+	    job_busy_ms = 0;
+	    job_costs_next.clear();
+	    last_search_depth = depth;
+	    job_costs_pending = true;
+	    search_epoch = ++cluster.epoch;
+	    search_keys = key_history;
+	    search_history = cluster.newHistory();
+	    Move pv_move = expectedPVMove();
 	    //cout << "MPI search queue of " << m << " moves W: "<< white_to_move << endl;
 	    for (uint i = 0; i < m; i ++) {
 	        E_PIECE took;
@@ -344,118 +512,341 @@ struct Game {
 	        sreq.instruction.mate_search = limits.mate_search;
 	        sreq.instruction.pos_score_enabled = limits.pos_score_enabled;
 	        sreq.rank = 0;
+	        sreq.affinity = subtreeOwner(new_board, !white_to_move);
+	        sreq.id = cluster.next_job_id++;
 	        sreq.search_request = moves[i];
+	        sreq.cost = moves[i] == pv_move ? UINT64_MAX : estimateCost(new_board, depth);
 	        searchq.push_back(sreq);
 	    }
+	    // Largest first keeps the tail of the root barrier short, the expected PV move leads
+	    searchq.sort([](const MoveSearchRequest_s &a, const MoveSearchRequest_s &b) { return a.cost > b.cost; });
 	}
 
-	// return true if q is empty
-	bool processSearchQ() {
-		vector<bool> busy_ranks(cpu_count, false);
-		for (auto &sr : searchq) 
-			busy_ranks[sr.rank] = true; 
+	// Collect the results of this game's jobs, returns true while some are still out
+	uint64_t eval_probes = 0, eval_hits = 0, pawn_probes = 0, pawn_hits = 0; // worker cache counters, summed
+
+	bool receiveResults() {
+		cluster.receive([&](WireResult &w, int rank) {
+			for (auto &sr : searchq)
+				if (sr.id == w.id && sr.rank == rank && !sr.done) {
+					sr.result.best = unpackResult(w);
+					sr.result.evals = w.evals;
+					sr.result.ms_taken = w.ms_taken;
+					sr.result.finished = w.halted;
+					sr.done = true;
+					eval_probes += w.eval_probes;
+					eval_hits += w.eval_hits;
+					pawn_probes += w.pawn_probes;
+					pawn_hits += w.pawn_hits;
+					return true;
+				}
+			return false;
+		});
+		for (auto &sr : searchq)
+			if (sr.rank > 0 && !sr.done)
+				return true;
+		return false;
+	}
 
-		// Deploy loop
-		for (auto &sr : searchq) {
-			if (sr.rank > 0)
-				continue;
-			// find rank not busy
-			auto it = find(busy_ranks.begin(), busy_ranks.end(), false);
-			if (it == busy_ranks.end()) break; // all ranks busy
-    		int idle_rank = it - busy_ranks.begin();
-    		busy_ranks[idle_rank] = true;
-    		sr.rank = idle_rank;
-    		//cout << "GO FOR " << idle_rank << " " << moves_to_crunch - 1 << endl;
-    		MPI_Send((void *) &sr.instruction, sizeof(sr.instruction), MPI_BYTE, idle_rank, 0, MPI_COMM_WORLD);
-    		MPI_Irecv((void *) &sr.result, sizeof(CruncherResult_s), MPI_BYTE, idle_rank, 0, MPI_COMM_WORLD, &sr.mpi_request);
-    	}
+	// return true if q is empty. At most max_jobs go out, the server shares the free slots between games.
+	bool processSearchQ(int max_jobs = INT32_MAX) {
+		// Deploy loop, queue is in dispatch order. Spread the front of the queue over the ranks first,
+		// then top up their local queues. Jobs for one rank go out in a single message.
+		vector<vector<WireJob>> batches(cpu_count);
+		auto assign = [&](MoveSearchRequest_s &sr, int rank) {
+			max_jobs--;
+			sr.rank = rank;
+			sr.dispatched = now();
+			uint8_t flags = (sr.instruction.mate_search ? JOB_MATE_SEARCH : 0) | (sr.instruction.pos_score_enabled ? JOB_POS_SCORE : 0);
+			// a mate job carries the attacker moves left after the defender's reply instead of plies
+			int depth = sr.instruction.mate_search ? sr.instruction.mate_search - 1 : sr.instruction.depth;
+			WireJob job = packJob(sr.instruction.position, sr.instruction.white_to_move, depth, flags);
+			job.id = sr.id;
+			job.epoch = search_epoch;
+			job.cache_bits = packCacheBits(limits.eval_cache_bits, limits.pawn_hash_bits);
+			batches[rank].push_back(job);
+		};
+		// jobs whose subtree a rank already holds go there if it has room
+		for (auto &sr : searchq)
+			if (sr.rank == 0 && max_jobs > 0 && sr.affinity > 0 && sr.affinity < cpu_count &&
+			    cluster.freeSlots(sr.affinity) > int(batches[sr.affinity].size()) && cluster.canSend(sr.affinity, search_history))
+				assign(sr, sr.affinity);
+		auto queued = [](const MoveSearchRequest_s &sr) { return sr.rank == 0; };
+		auto sr_it = find_if(searchq.begin(), searchq.end(), queued);
+		for (int slot = 0; slot < cluster.capacity && sr_it != searchq.end() && max_jobs > 0; slot++)
+			for (int rank = 1; rank < cpu_count && sr_it != searchq.end() && max_jobs > 0; rank++) {
+				if (!cluster.freeSlots(rank) || cluster.inflight[rank] + int(batches[rank].size()) > slot || !cluster.canSend(rank, search_history))
+					continue;
+				assign(*sr_it, rank);
+				sr_it = find_if(++sr_it, searchq.end(), queued);
+			}
+		for (int rank = 1; rank < cpu_count; rank++)
+			if (!batches[rank].empty())
+				cluster.send(rank, batches[rank].data(), batches[rank].size(), search_history, &search_keys);
 
-    	// Check at all non-idle ranks if they finished
+		receiveResults();
+		bool improved = false;
     	auto it = searchq.begin();
     	while (it != searchq.end()) {
     		auto &sr = *it;
-    		if (sr.rank > 0) {
-	    		int done = 0;
-	    		MPI_Test(&sr.mpi_request, &done, MPI_STATUS_IGNORE);
-	    		if (done) {
+    		if (sr.done) {
 	    			EvalResult result = sr.result.best;
 	        		result.score = -result.score;
 	        		result.move = result.lot[sr.instruction.depth+1] = sr.search_request;
+	        		if (!sr.result.finished) { // halted jobs would spoil the estimate
+	        			job_costs_next.push_back({sr.instruction.position, sr.result.evals});
+	        			if (subtree_owner.size() > 4096)
+	        				subtree_owner.clear();
+	        			subtree_owner[hashKey(sr.instruction.position, sr.instruction.white_to_move)] = sr.rank;
+	        		}
 	        		evals += sr.result.evals;
+	        		job_busy_ms += sr.result.ms_taken;
+	        		busy_ms_total += sr.result.ms_taken;
+	        		jobs_total++;
 	        		fixLOT(result);
 	        		if (limits.debug_mainline) {
+	        			cout << "info string job " << current.move2str(sr.search_request) << "rank " << sr.rank << " cost " << sr.cost
+	        				 << " nodes " << sr.result.evals << " ms " << sr.result.ms_taken << " wall " << since(sr.dispatched)
+	        				 << " start " << sr.dispatched - last_search_start << endl;
 	        			cout << "M"<<searchq.size()<< ": " << sr.result.evals / (sr.result.ms_taken+1) << " EPMS. ";printMove(result); cout <<endl;
 	        		}
+	        		// a new line among the best multipv ones is worth an info update
+	        		improved |= count_if(last_search_result.begin(), last_search_result.end(),
+	        				[&](const EvalResult &e) { return e.score >= result.score; }) < max(1, limits.multipv);
 	        		last_search_result.push_back(result);
 	        		it = searchq.erase(it);
 	        		continue;
-	    		}
     		}
    			++it;
     	}
+    	if (!searchq.empty() && reporting && improved)
+    		printLines(since(last_search_start) + 1);
+    	if (!searchq.empty() && reporting && improved && decided()) {
+    		stopSearchMPI();
+    		for (auto &sr : searchq) // halted, only their nodes count
+    			evals += sr.result.evals;
+    		searchq.clear();
+    	}
     	if (searchq.size() == 0) {
     		last_search_ms = since(last_search_start);
+    		if (job_costs_pending && !last_search_result.empty()) {
+    			job_costs_pending = false;
+    			recordJobCosts(last_search_depth);
+    			if (limits.debug_mainline)
+    				cout << "info string makespan " << last_search_ms << " busy " << job_busy_ms << " ranks " << cpu_count - 1
+    					 << " utilization " << (100 * job_busy_ms) / ((last_search_ms + 1) * max(1, cpu_count - 1)) << "%" << endl;
+    		}
     		//if (evals > 0) cout << "TOOK: " << last_search_ms << "ms, PERF: " <<  evals/(last_search_ms+1) << " e/ms.\n";
     		return true;
     	}
     	return false;
 	}
 
+	// The legal start of the line in lot[depth..1] from b: it stops at an end mark, at a move that is not legal and
+	// where the game is over. Returns its length, line gets the moves if given, mated says whether the line ends
+	// in checkmate.
+	static int legalLine(Board b, bool white, const EvalResult &r, int depth, Move *line, bool &mated) {
+		Move moves[128];
+		Board boards[128];
+		int plies = 0;
+		for (int j = depth; j > 0 && r.lot[j] != 0 && r.lot[j] < 0xFFCC && MateSolver::legal(b, white, moves, boards) &&
+		     isLegal(b, white, r.lot[j]); j--, plies++) {
+			if (line)
+				line[plies] = r.lot[j];
+			E_PIECE took;
+			b = b.move(r.lot[j], took);
+			white = !white;
+		}
+		mated = plies && MateSolver::inCheck(b, white) && !MateSolver::legal(b, white, moves, boards);
+		return plies;
+	}
+
+	// Plies along the line to a checkmate of the side to move, 0 if the line does not end in one. The score of a
+	// mate holds the depth left at the king capture, not the distance, so the line is played out.
+	int matePlies(const EvalResult &r) {
+		bool mated;
+		int plies = legalLine(current, white_to_move, r, last_search_depth, nullptr, mated);
+		return mated ? plies : 0;
+	}
+
+	// UCI score, mate N when the line shows it or it ends in the tables
+	string scoreUCI(const EvalResult &r) {
+		int plies = abs(r.score) >= INT32_MAX / 4 ? matePlies(r) : 0;
+		if (!plies)
+			plies = tbMatePlies(r.score, last_search_depth);
+		if (!plies)
+			return "cp " + to_string(r.score);
+		return "mate " + to_string(plies % 2 ? (plies + 1) / 2 : -plies / 2);
+	}
+
+	// The best multipv results so far, highest first
+	void printLines(int ms) {
+		ExtendedEvalResult top = last_search_result;
+		int n = min<int>(max(1, limits.multipv), top.size());
+		partial_sort(top.begin(), top.begin() + n, top.end(), greater<EvalResult>());
+		for (int k = 0; k < n; k++)
+			printMoveUCI(top[k], last_search_depth, scoreUCI(top[k]), ms, k + 1);
+	}
+
+	// True when the jobs still out cannot beat the best result: it mates at once, or it mates in two and no
+	// remaining move mates at once. Deeper mates could be beaten by any job that has not reported.
+	bool decided() {
+		if (limits.multipv > 1)
+			return false;
+		auto &best = *max_element(last_search_result.begin(), last_search_result.end());
+		int plies = matePlies(best);
+		if (plies == 1) // nothing mates faster
+			return true;
+		if (plies != 3 || best.score < INT32_MAX / 4) // a line, not a forced mate
+			return false;
+		Move moves[128];
+		Board boards[128];
+		for (auto &sr : searchq)
+			if (MateSolver::inCheck(sr.instruction.position, !white_to_move) && !MateSolver::legal(sr.instruction.position, !white_to_move, moves, boards))
+				return false;
+		return true;
+	}
+
+	// Walks the line of thought and marks where it ends. A legal move means the position is not terminal,
+	// so the full move list is only built when the line stops.
 	void fixLOT(EvalResult &r) {
 		int d = MAX_DEPTH-1;
-		Game g = Game(current, white_to_move);
+		Board b = current;
+		bool white = white_to_move;
 		while(r.lot[d] == 0 && d > 0) d--;
 	    for (int j = d; j > 0; j--) {
 	    	auto &next_move = r.lot[j];
-	    	if (g.isMate()) {
-	    		next_move = 0;
-	    		break;
-	    	}
-	    	if (g.isStaleMate()) {
-	    		next_move = 0xFFFF;
-	    		r.score = 0; // DRAW!
+	    	if (next_move == 0xFFDD || next_move == 0xFFCC)
 	    		break;
-	    	}
-	    	if (!g.isValidMove(next_move)) {
-	    		r.lot[j-1] = 0xFFEE;
+	    	if (!isLegal(b, white, next_move)) {
+	    		MoveArray moves;
+	    		if (rootMoves(b, white, moves) > 0)
+	    			r.lot[j-1] = 0xFFEE;
+	    		else if (b.isCheck(white))
+	    			next_move = 0; // mate
+	    		else {
+	    			next_move = 0xFFFF;
+	    			r.score = 0; // DRAW!
+	    		}
 	    		break;
 	    	}
-			g.execMove(next_move);
+	    	E_PIECE took;
+	    	b = b.move(next_move, took);
+	    	white = !white;
 	    }
 	}
 
-	// did current board appear in history more or equal than n times?
+	// how often did the current position appear before?
 	uint32_t checkRepetition() {
 		uint32_t count = 0;
-		for (const auto& b : board_history)
-			if (current == b)
+		for (int i = int(key_history.size()) - 5; i >= 0; i -= 2)
+			if (key_history[i] == key_history.back())
 				count++;
-		return count > 0 ? count-1 : 0;
-	} 
-
-	void receiverLoop() {
-		CruncherInstruction_s CruncherInstruction;
-		CruncherResult_s CruncherResult;
-		MPI_Request incoming_request;
-		int flag = 0;
-		while(1) {
+		return count;
+	}
+
+	// Worker side, runs jobs until the end of the process. Threads pass their slot and return on quit.
+	void receiverLoop(JobSlot *thread_slot = nullptr) {
+		WorkerLink link;
+		deque<QueuedJob> jobs;
+		uint8_t epoch = 0;
+		TimePoint last_job = 0;
+		link.init(thread_slot);
+		while(!thread_slot || !atomic_ref(thread_slot->quit).load(memory_order_relaxed)) {
+			link.poll(jobs);
+			if (jobs.empty()) {
+				if (since(last_job) > 2) // spin shortly after a job, the next one is usually on its way
+					sleep_us(50);
+				continue;
+			}
+			auto [job, shm] = jobs.front();
+			jobs.pop_front();
+			halt_token = HALT_TOKEN(job.epoch);
+			if (job.epoch != epoch) { // first job of a new search, forget an old stop unless it is for this one
+				epoch = job.epoch;
+				if (*engine_halt != halt_token && *engine_halt != HALT_ALL)
+					*engine_halt = 0;
+#ifdef ENG_HASH_TABLES
+				tables.newSearch();
+#endif
+			}
+#ifdef ENG_HASH_TABLES
+			if (job.flags & JOB_CLEAR_TABLES || tables.tt.empty())
+				tables.clear();
+#endif
+			if (job.flags & JOB_CLEAR_TABLES && !mate_solver.tt.empty())
+				mate_solver.clear();
+			if (job.flags & JOB_HISTORY)
+				link.history(rep_history, shm);
 			ResetStats();
-			CruncherResult.finished = true;
-			MPI_Irecv((void *)&CruncherInstruction, sizeof(CruncherInstruction), MPI_BYTE, 0, 0, MPI_COMM_WORLD, &incoming_request);
-			do {
-				MPI_Test(&incoming_request, &flag, MPI_STATUS_IGNORE);
-				sleep_ms(1);
-			} while (!flag);
-			*engine_halt = 0;  // in case we were stopped
-			limits.mate_search = CruncherInstruction.mate_search;
-			limits.pos_score_enabled = CruncherInstruction.pos_score_enabled;
-			//CruncherInstruction.position.print();
+			limits.mate_search = job.flags & JOB_MATE_SEARCH;
+			limits.pos_score_enabled = job.flags & JOB_POS_SCORE;
+			unpackCacheBits(job.cache_bits, limits.eval_cache_bits, limits.pawn_hash_bits);
+			eval_tables.resize(limits.eval_cache_bits, limits.pawn_hash_bits);
+			eval_tables.eval_probes = eval_tables.eval_hits = eval_tables.pawn_probes = eval_tables.pawn_hits = 0;
+#ifdef ENG_STATS
+			search_stats = {};
+			stats_root_depth = job.depth;
+#endif
+			Board position = unpackBoard(job);
 			auto t_start = now();
-			CruncherResult.best = f_pvs(CruncherInstruction.depth, CruncherInstruction.position, INT32_MIN + 1, INT32_MAX, CruncherInstruction.white_to_move, -1, 0);
-		    CruncherResult.ms_taken = since(t_start);
-		    CruncherResult.evals = evals;
-			CruncherResult.finished = *engine_halt;
-		    MPI_Send((void *)&CruncherResult, sizeof(CruncherResult), MPI_BYTE, 0, 0, MPI_COMM_WORLD);
+#ifdef ENG_NNUE
+			if (nnue.net)
+				nnue.refresh(nnue_acc[job.depth], position);
+#endif
+			EvalResult best;
+			if (job.flags & JOB_ROOT) { // a position of its own, no game history comes with it
+				if (!(job.flags & JOB_HISTORY))
+					rep_history.set(nullptr, 0);
+#ifdef ENG_HASH_TABLES
+				tables.newSearch();
+#endif
+				search_deadline = job.movetime ? t_start + job.movetime : 0;
+				search_node_limit = job.nodes;
+				search_limit_hit = false;
+				best = f_root(job.depth, position, job.flags & JOB_WHITE_TO_MOVE);
+				search_deadline = search_node_limit = 0;
+				search_limit_hit = false;
+			} else
+				best = job.flags & JOB_MATE_SEARCH ? mate_solver.solve(position, job.flags & JOB_WHITE_TO_MOVE, job.depth)
+				                                   : f_pvs(job.depth, position, INT32_MIN + 1, INT32_MAX, job.flags & JOB_WHITE_TO_MOVE, -1, 0);
+			WireResult result = packResult(best, evals, since(t_start), haltRequested());
+			result.id = job.id;
+			result.eval_probes = eval_tables.eval_probes;
+			result.eval_hits = eval_tables.eval_hits;
+			result.pawn_probes = eval_tables.pawn_probes;
+			result.pawn_hits = eval_tables.pawn_hits;
+#ifdef ENG_STATS
+			result.stats = search_stats;
+#endif
+			link.send(result, shm);
+			last_job = now();
 		}
 	}
 };
+
+void Cluster::startThreads(int n) {
+	stopThreads();
+	threaded = true;
+	cpu_count = n + 1;
+	thread_slots = vector<JobSlot>(cpu_count);
+	slot.assign(cpu_count, nullptr);
+	for (int rank = 1; rank < cpu_count; rank++) {
+		slot[rank] = &thread_slots[rank];
+		threads.emplace_back([this, rank]() {
+			Game g;
+			g.receiverLoop(slot[rank]);
+		});
+	}
+	init();
+}
+
+void Cluster::stopThreads() {
+	for (auto &s : thread_slots) {
+		atomic_ref(s.halt).store(HALT_ALL, memory_order_relaxed);
+		atomic_ref(s.quit).store(1, memory_order_relaxed);
+	}
+	for (auto &t : threads)
+		t.join();
+	threads.clear();
+}
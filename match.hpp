@@ -0,0 +1,299 @@
+// Self-play matches between two settings of the engine, A and B. Many games run at once, every move is a whole
+// position job with the side's own limits, so the workers play the games in parallel and rank 0 only keeps score.
+// Each opening is played twice with colors swapped. The games end by the rules (mate, stalemate, threefold
+// repetition, fifty moves), by the endgame tables or at maxplies. An SPRT can stop the match early.
+// match [games N] [concurrency N] [openings file] [random plies] [maxplies N] [pgn file] [sprt elo0 elo1]
+//       [alpha a] [beta b] [depth|movetime|nodes|posscore V] [a.depth|a.movetime|... V] [b.depth|... V]
+
+#include <random>
+#include <cmath>
+#include <iomanip>
+
+#define MATCH_START_FEN "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1"
+
+struct MatchSide {
+	int depth = 0;			// 0: limits.depth, or no depth limit with movetime or nodes
+	uint32_t movetime = 0;	// ms per move
+	uint32_t nodes = 0;		// evals per move
+	bool pos_score = true;
+
+	string name() {
+		string s = "muller";
+		if (depth)
+			s += " depth " + to_string(depth);
+		if (movetime)
+			s += " movetime " + to_string(movetime);
+		if (nodes)
+			s += " nodes " + to_string(nodes);
+		return s + (pos_score ? "" : " posscore 0");
+	}
+};
+
+struct MatchConfig {
+	MatchSide side[2];		// A, B
+	int games = 100;
+	int concurrency = 0;	// games at once, 0: two per worker
+	string openings, pgn;
+	int random_plies = -1;	// random moves after the opening, -1: 8 without an openings file, 0 with one
+	int max_plies = 400;	// draw adjudication
+	bool sprt = false;
+	double elo0 = 0, elo1 = 5, alpha = 0.05, beta = 0.05;
+	TrainingWriter *data = nullptr;	// datagen: searched positions go here, a progress line every 100 games
+};
+
+// Generalized SPRT on the game scores, normal approximation of the trinomial model
+struct Sprt {
+	double lower, upper, s0, s1;
+
+	Sprt(const MatchConfig &mc) {
+		lower = log(mc.beta / (1 - mc.alpha));
+		upper = log((1 - mc.beta) / mc.alpha);
+		s0 = 1 / (1 + pow(10, -mc.elo0 / 400));
+		s1 = 1 / (1 + pow(10, -mc.elo1 / 400));
+	}
+
+	static void stats(int w, int d, int l, double &x, double &var) {
+		int n = w + d + l;
+		x = (w + d / 2.0) / n;
+		var = (w * (1 - x) * (1 - x) + d * (0.5 - x) * (0.5 - x) + l * x * x) / n;
+	}
+
+	double llr(int w, int d, int l) {
+		if (w + d + l == 0)
+			return 0;
+		double x, var;
+		stats(w, d, l, x, var);
+		if (var <= 0)
+			return 0;
+		return (w + d + l) * (s1 - s0) * (2 * x - s0 - s1) / (2 * var);
+	}
+};
+
+static double scoreToElo(double x) {
+	x = clamp(x, 1e-6, 1 - 1e-6);
+	return 400 * log10(x / (1 - x));
+}
+
+struct MatchGame {
+	Game g;
+	int number;				// 1 based
+	bool a_white;
+	string fen;				// opening position
+	vector<string> san;		// every move from fen, random plies included
+	string result, reason;
+	bool adjudicated = false;
+	vector<TrainingRecord> records; // datagen, the result is filled in at the end
+
+	MatchGame(const string &opening) : g(opening), fen(opening) {}
+
+	void play(Move m) {
+		san.push_back(Game::san(g.current, g.white_to_move, m));
+		g.execMove(m);
+	}
+
+	// Fully legal, castling included
+	vector<Move> legal() {
+		Move moves[128];
+		Board boards[128];
+		int n = MateSolver::legal(g.current, g.white_to_move, moves, boards);
+		return vector<Move>(moves, moves + n);
+	}
+
+	// Sets result and returns true if the game is over before the side to move searches
+	bool over(int max_plies) {
+		string win = g.white_to_move ? "0-1" : "1-0";
+		bool check = MateSolver::inCheck(g.current, g.white_to_move);
+		int32_t score;
+		if (legal().empty()) {
+			result = check ? win : "1/2-1/2";
+			reason = check ? "mate" : "stalemate";
+		} else if (g.checkRepetition() >= 2) {
+			result = "1/2-1/2";
+			reason = "threefold repetition";
+		} else if (g.key_history.size() > 100) {
+			result = "1/2-1/2";
+			reason = "fifty moves";
+		} else if (popcount(g.current.position) <= 3 && bitbases.probe(g.current, g.white_to_move, 0, score)) {
+			result = score == 0 ? "1/2-1/2" : score > 0 ? (g.white_to_move ? "1-0" : "0-1") : win;
+			reason = score == 0 ? "drawn ending" : "endgame tables";
+			adjudicated = true;
+		} else if (int(san.size()) >= max_plies) {
+			result = "1/2-1/2";
+			reason = "max plies";
+			adjudicated = true;
+		}
+		return !result.empty();
+	}
+
+	// Points of A
+	double scoreA() { return result == "1/2-1/2" ? 0.5 : (result == "1-0") == a_white; }
+
+	void writePgn(ostream &out, const MatchConfig &mc) {
+		time_t t = time(nullptr);
+		char date[16];
+		strftime(date, sizeof(date), "%Y.%m.%d", localtime(&t));
+		MatchSide a = mc.side[0], b = mc.side[1];
+		string name_a = "A " + a.name(), name_b = "B " + b.name();
+		out << "[Event \"muller match\"]\n[Site \"?\"]\n[Date \"" << date << "\"]\n[Round \"" << number << "\"]\n"
+			<< "[White \"" << (a_white ? name_a : name_b) << "\"]\n[Black \"" << (a_white ? name_b : name_a) << "\"]\n";
+		out << "[Result \"" << result << "\"]\n";
+		if (fen != MATCH_START_FEN)
+			out << "[FEN \"" << fen << "\"]\n[SetUp \"1\"]\n";
+		out << "[PlyCount \"" << san.size() << "\"]\n";
+		if (adjudicated)
+			out << "[Termination \"adjudication\"]\n";
+		out << "\n";
+		string line;
+		auto word = [&](const string &w) {
+			if (line.size() + w.size() + 1 > 79) {
+				out << line << "\n";
+				line.clear();
+			}
+			line += (line.empty() ? "" : " ") + w;
+		};
+		bool white = g.first_white;
+		for (size_t i = 0; i < san.size(); i++, white = !white) {
+			if (white)
+				word(to_string((i + !g.first_white) / 2 + 1) + ".");
+			else if (i == 0)
+				word("1...");
+			word(san[i]);
+		}
+		word("{" + reason + "}");
+		word(result);
+		out << line << "\n\n";
+	}
+};
+
+vector<string> matchOpenings(const MatchConfig &mc) {
+	vector<string> fens;
+	if (!mc.openings.empty())
+		for (auto &p : readEpd(mc.openings))
+			fens.push_back(p.fen);
+	if (fens.empty())
+		fens.push_back(MATCH_START_FEN);
+	return fens;
+}
+
+// Both games of a pair get the same opening, the random plies are seeded with the pair
+unique_ptr<MatchGame> newMatchGame(const MatchConfig &mc, const vector<string> &openings, int number) {
+	int pair = (number - 1) / 2;
+	auto m = make_unique<MatchGame>(openings[pair % openings.size()]);
+	m->number = number;
+	m->a_white = (number - 1) % 2 == 0;
+	mt19937 rng(pair);
+	int plies = mc.random_plies >= 0 ? mc.random_plies : mc.openings.empty() ? 8 : 0;
+	for (int i = 0; i < plies; i++) {
+		auto moves = m->legal();
+		if (moves.empty())
+			break;
+		m->play(moves[rng() % moves.size()]);
+	}
+	return m;
+}
+
+void runMatch(MatchConfig mc) {
+	for (auto &s : mc.side)
+		if (!s.depth)
+			s.depth = s.movetime || s.nodes ? MAX_DEPTH - 1 : limits.depth;
+	auto openings = matchOpenings(mc);
+	int workers = max(1, cpu_count - 1);
+	int concurrency = mc.concurrency > 0 ? mc.concurrency : 2 * workers;
+	ofstream pgn;
+	if (!mc.pgn.empty())
+		pgn.open(mc.pgn, ios::app);
+	// transposition entries carry the eval of the side that stored them, different evals start each move afresh
+	bool fresh_tables = cluster.fresh_tables;
+	cluster.fresh_tables = mc.side[0].pos_score != mc.side[1].pos_score;
+	cout << "info string match A " << mc.side[0].name() << " vs B " << mc.side[1].name() << ", " << mc.games << " games, "
+		 << openings.size() << " openings, " << concurrency << " at once on " << workers << " workers" << endl;
+
+	Sprt sprt(mc);
+	RootSearch rs;
+	unordered_map<int, unique_ptr<MatchGame>> running;
+	int started = 0, finished = 0, wins = 0, draws = 0, losses = 0;
+	uint64_t nodes = 0;
+	bool stop = false, cancelled = false;
+	auto t_start = now();
+
+	// Submits the next move of the game, or scores it if it is over. Returns false for a finished game.
+	auto next = [&](MatchGame &m) {
+		if (!m.over(mc.max_plies)) {
+			MatchSide &s = mc.side[m.g.white_to_move != m.a_white];
+			vector<uint64_t> history(m.g.key_history.begin(), m.g.key_history.end() - 1); // the job pushes the root
+			rs.submit(m.g.current, m.g.white_to_move, s.depth, s.movetime, s.nodes, m.number, s.pos_score, history);
+			return true;
+		}
+		double a = m.scoreA();
+		wins += a == 1;
+		draws += a == 0.5;
+		losses += a == 0;
+		finished++;
+		if (pgn.is_open())
+			m.writePgn(pgn, mc);
+		if (mc.data) {
+			int8_t white_result = m.result == "1-0" ? 1 : m.result == "0-1" ? -1 : 0;
+			for (auto &rec : m.records)
+				rec.result = rec.white_to_move ? white_result : -white_result;
+			mc.data->push(move(m.records));
+			if (finished % 100 && finished != mc.games)
+				return false;
+		}
+		double x, var;
+		Sprt::stats(wins, draws, losses, x, var);
+		double margin = 1.96 * sqrt(var / finished);
+		cout << "info string match game " << m.number << " " << (m.a_white ? "A-B " : "B-A ") << m.result << " " << m.reason
+			 << " " << m.san.size() << " plies, A +" << wins << " =" << draws << " -" << losses << " elo " << fixed << setprecision(1)
+			 << scoreToElo(x) << " +- " << (scoreToElo(min(1.0, x + margin)) - scoreToElo(max(0.0, x - margin))) / 2;
+		if (mc.sprt) {
+			double llr = sprt.llr(wins, draws, losses);
+			cout << " llr " << setprecision(2) << llr << " [" << sprt.lower << ", " << sprt.upper << "]";
+			if (llr >= sprt.upper || llr <= sprt.lower) {
+				cout << (llr >= sprt.upper ? " H1 accepted" : " H0 accepted");
+				stop = true;
+			}
+		}
+		cout << defaultfloat << setprecision(6) << endl;
+		return false;
+	};
+
+	RootResult r;
+	while (true) {
+		while (!stop && started < mc.games && int(running.size()) < concurrency) {
+			auto m = newMatchGame(mc, openings, ++started);
+			if (next(*m))
+				running[m->number] = move(m);
+		}
+		if (stop && !cancelled) { // the games still running are dropped
+			rs.cancel();
+			running.clear();
+			cancelled = true;
+		}
+		if (!rs.pending())
+			break;
+		if (!rs.poll(r)) {
+			sleep_us(50);
+			continue;
+		}
+		nodes += r.evals;
+		auto it = running.find(r.tag);
+		if (it == running.end())
+			continue;
+		MatchGame &m = *it->second;
+		Move move = r.best.move;
+		if (mc.data)
+			m.records.push_back(packTraining(m.g.current, m.g.white_to_move, r.best.score));
+		m.play(move);
+		if (!next(m))
+			running.erase(it);
+	}
+	uint64_t ms = since(t_start);
+	double x = 0.5, var = 0;
+	if (finished)
+		Sprt::stats(wins, draws, losses, x, var);
+	cout << "info string match A +" << wins << " =" << draws << " -" << losses << " of " << finished << " games, score " << fixed
+		 << setprecision(1) << 100 * x << "%, elo " << scoreToElo(x) << defaultfloat << setprecision(6) << ", " << ms << " ms, "
+		 << nodes << " nodes, " << nodes * 1000 / (ms + 1) << " nps" << endl;
+	cluster.fresh_tables = fresh_tables;
+	ResetStats();
+}
@@ -0,0 +1,200 @@
+// Mate solver for "go mate N" jobs. A boolean AND/OR search instead of the full width f_pvs: the attacker tries
+// checks first, ordered by how few replies the defender has left (the proof number of the child, in
+// proof-number search terms), the defender only has to find one reply that escapes. A first pass allows checking
+// attacker moves only, the second pass falls back to all moves. Proven and refuted attacker nodes go into a
+// per worker table keyed by position and pass.
+
+#define MATE_TT_BITS 18
+#define MATE_SCORE (INT32_MAX / 2 + 64) // attacker's view, minus the attacker moves needed
+
+struct MateEntry {
+    uint64_t key;
+    uint8_t proven;     // mate in this many moves or less, 0xFF if unknown
+    uint8_t refuted;    // no mate in this many moves or less, 0 if unknown
+    Move move;
+};
+
+// Lot index of the job root's move, the line is cut to fit the LOT
+static inline int mateLotDepth(int n) { return min(2 * n, MAX_DEPTH - 1) - 1; }
+
+struct MateSolver {
+    vector<MateEntry> tt;
+    bool checks_only;
+    uint64_t nodes;
+
+    void clear() {
+        tt.assign(1 << MATE_TT_BITS, {0, 0xFF, 0, 0});
+    }
+
+    static uint64_t king(Board &b, bool white) {
+        auto pcs = b.pieces_single;
+        E_PIECE k = white ? W_KING : B_KING;
+        for (uint64_t pos = b.position; pos; pos &= pos - 1) {
+            if ((uint8_t(pcs) & 0xF) == k)
+                return pos & -pos;
+            pcs >>= 4;
+        }
+        return 0;
+    }
+
+    static bool inCheck(Board &b, bool white) { return b.attacks(!white) & king(b, white); }
+
+    // Legal moves with their boards. Castling must not start in or pass through check.
+    static int legal(Board &b, bool white, Move *moves, Board *boards) {
+        MoveArray pseudo;
+        int n = b.moves(white, pseudo), l = 0;
+        uint64_t attacked = 0;
+        bool attacked_known = false;
+        for (int i = 0; i < n; i++) {
+            E_PIECE taken, pc = b.getPiece(move_from(pseudo[i]));
+            if ((pc == W_KING || pc == B_KING) && abs(get_file(move_from(pseudo[i])) - get_file(move_to(pseudo[i]))) == 2) {
+                if (!attacked_known) {
+                    attacked = b.attacks(!white);
+                    attacked_known = true;
+                }
+                int from = move_from(pseudo[i]), to = move_to(pseudo[i]);
+                uint64_t path = (1ULL << from) | (1ULL << ((from + to) / 2)) | (1ULL << to);
+                if (attacked & path)
+                    continue;
+            }
+            Board c = b.move(pseudo[i], taken);
+            if (taken == W_KING || taken == B_KING || inCheck(c, white))
+                continue;
+            moves[l] = pseudo[i];
+            boards[l++] = c;
+        }
+        return l;
+    }
+
+    MateEntry &entry(uint64_t key) { return tt[key & (tt.size() - 1)]; }
+
+    // Attacker to move: mate in n moves or less?
+    bool attack(Board &b, bool white, int n) {
+        if (n == 0 || searchHalted())
+            return false;
+        uint64_t key = hashKey(b, white) ^ (checks_only ? zobrist.checks_only : 0);
+        MateEntry &e = entry(key);
+        if (e.key == key && e.proven <= n)
+            return true;
+        if (e.key == key && e.refuted >= n)
+            return false;
+
+        Move moves[128];
+        Board boards[128];
+        int l = legal(b, white, moves, boards);
+        // checks first, fewest replies first. Only checks can mate in one, in the first pass they are all we try.
+        int replies[128], order[128], m = 0;
+        Move dummy[128];
+        Board dummy_boards[128];
+        for (int i = 0; i < l; i++) {
+            bool check = inCheck(boards[i], !white);
+            if (!check && (n == 1 || checks_only))
+                continue;
+            replies[i] = check ? legal(boards[i], !white, dummy, dummy_boards) : 256;
+            order[m++] = i;
+        }
+        stable_sort(order, order + m, [&](int a, int c) { return replies[a] < replies[c]; });
+
+        bool proven = false;
+        Move best = 0;
+        for (int k = 0; k < m && !proven; k++) {
+            int i = order[k];
+            if (replies[i] == 0) // mate or stalemate right here
+                proven = inCheck(boards[i], !white);
+            else
+                proven = defend(boards[i], !white, n - 1);
+            if (proven)
+                best = moves[i];
+        }
+        if (searchHalted())
+            return false;
+        if (e.key != key)
+            e = {key, 0xFF, 0, 0};
+        if (proven) {
+            e.proven = min<int>(e.proven, n);
+            e.move = best;
+        } else
+            e.refuted = max<int>(e.refuted, n);
+        return proven;
+    }
+
+    // Defender to move: does every reply run into mate in n moves or less?
+    bool defend(Board &b, bool white, int n) {
+        nodes++;
+        Move moves[128];
+        Board boards[128];
+        int l = legal(b, white, moves, boards);
+        if (l == 0)
+            return inCheck(b, white);
+        if (n == 0)
+            return false;
+        for (int i = 0; i < l; i++)
+            if (!attack(boards[i], !white, n))
+                return false;
+        return true;
+    }
+
+    // Line from a proven defender node: the reply that holds out longest, then the attacker's proof move
+    void line(Board b, bool white, int n, EvalResult &r, int d) {
+        while (d > 0) {
+            Move moves[128];
+            Board boards[128];
+            int l = legal(b, white, moves, boards);
+            if (l == 0)
+                return; // mate, lot below stays 0
+            int longest = -1, k_longest = -1;
+            for (int i = 0; i < l; i++)
+                for (int k = 1; k <= n; k++)
+                    if (attack(boards[i], !white, k)) {
+                        if (k > k_longest) {
+                            k_longest = k;
+                            longest = i;
+                        }
+                        break;
+                    }
+            if (longest < 0)
+                return;
+            r.lot[d--] = moves[longest];
+            b = boards[longest];
+            n = k_longest;
+            uint64_t key = hashKey(b, !white) ^ (checks_only ? zobrist.checks_only : 0);
+            MateEntry &e = entry(key);
+            if (d == 0 || e.key != key || e.move == 0)
+                return;
+            r.lot[d--] = e.move;
+            E_PIECE taken;
+            b = b.move(e.move, taken);
+            n--;
+        }
+    }
+
+    // Job root: the defender is to move after the root move, the attacker has n more moves.
+    // Score from the defender's view like f_pvs, the faster the mate the larger it is for the attacker.
+    EvalResult solve(Board &b, bool white, int n) {
+        EvalResult r{};
+        if (tt.empty())
+            clear();
+        nodes = 0;
+        int d = mateLotDepth(n + 1);
+        for (int pass = 0; pass < 2 && r.score == 0; pass++) {
+            checks_only = pass == 0;
+            for (int k = 0; k <= n; k++) // shortest mate first
+                if (defend(b, white, k)) {
+                    r.score = -(MATE_SCORE - k - 1);
+                    r.depth = d;
+                    line(b, white, k, r, d);
+                    break;
+                }
+        }
+        if (r.score == 0)
+            r.lot[d] = 0xFFEE; // no line to show
+        evals += nodes;
+        return r;
+    }
+};
+thread_local MateSolver mate_solver;
+
+int rootMoves(Board &x, bool white, MoveArray moves) {
+    Board boards[128];
+    return MateSolver::legal(x, white, moves, boards);
+}
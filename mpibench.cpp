@@ -0,0 +1,124 @@
+#include "muller.hpp"
+
+/**
+ * @brief Dispatch overhead per job, rank 0 <-> workers.
+ * @details 1) plain ping-pong latency per rank, 2) the old protocol: one blocking MPI_Send of a
+ * CruncherInstruction_s and one MPI_Irecv of a CruncherResult_s per job, worker polling every ms,
+ * 3) the Cluster transport with depth 0 jobs against the real worker loop for every batch size, over
+ * MPI and over the node shared segment for ranks on rank 0's node.
+ * Depth 0 jobs do a single eval, so the time per job is almost all messaging.
+ *
+ * mpirun -n 5 ./mpibench [jobs]
+ **/
+
+#define TAG_BENCH_STOP 99
+
+int main(int argc, char *argv[]) {
+	MPI_Init(&argc, &argv);
+	MPI_Comm_size(MPI_COMM_WORLD, &cpu_count);
+	MPI_Comm_rank(MPI_COMM_WORLD, &crank);
+	MPI_Win_allocate(sizeof(int), sizeof(int), MPI_INFO_NULL, MPI_COMM_WORLD, (void *)&engine_halt, &eng_halt_win);
+	MPI_Win_fence(0, eng_halt_win);
+	if (cpu_count < 2) {
+		printf("This application is meant to be run with at least 2 MPI processes\n");
+		MPI_Abort(MPI_COMM_WORLD, EXIT_FAILURE);
+	}
+	int n_jobs = argc > 1 ? atoi(argv[1]) : 10000;
+	CruncherInstruction_s instruction{};
+	CruncherResult_s result{};
+
+	if (crank > 0) {
+		// echo loop for phase 1 and 2, then the real worker. Phase 2 polls like the old receiverLoop did.
+		MPI_Request request;
+		MPI_Status status;
+		char buffer[256];
+		int flag, tag = 0;
+		while (1) {
+			MPI_Irecv((void *)buffer, sizeof(buffer), MPI_BYTE, 0, MPI_ANY_TAG, MPI_COMM_WORLD, &request);
+			do {
+				MPI_Test(&request, &flag, &status);
+				if (!flag && tag == 1)
+					sleep_ms(1);
+			} while (!flag);
+			tag = status.MPI_TAG;
+			if (tag == TAG_BENCH_STOP)
+				break;
+			MPI_Send((void *)&result, tag == 1 ? sizeof(result) : 1, MPI_BYTE, 0, tag, MPI_COMM_WORLD);
+		}
+		cluster.initNode();
+		Game g;
+		g.receiverLoop(); // never returns
+	}
+
+	int workers = cpu_count - 1;
+	printf("%d workers, %d jobs per run\n", workers, n_jobs);
+
+	// 1) Ping-pong
+	auto t = steady_clock::now();
+	char c = 0;
+	for (int i = 0; i < n_jobs; i++) {
+		int rank = 1 + i % workers;
+		MPI_Send(&c, 1, MPI_BYTE, rank, 0, MPI_COMM_WORLD);
+		MPI_Recv(&c, 1, MPI_BYTE, rank, 0, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+	}
+	double us = duration<double, micro>(steady_clock::now() - t).count();
+	printf("ping-pong 1 byte            : %8.2f us/roundtrip\n", us / n_jobs);
+
+	// 2) Old protocol, one job per message and rank
+	vector<MPI_Request> req(cpu_count, MPI_REQUEST_NULL);
+	vector<CruncherResult_s> res(cpu_count);
+	t = steady_clock::now();
+	int sent = 0, received = 0;
+	while (received < n_jobs) {
+		for (int rank = 1; rank < cpu_count && sent < n_jobs; rank++)
+			if (req[rank] == MPI_REQUEST_NULL) {
+				MPI_Send((void *)&instruction, sizeof(instruction), MPI_BYTE, rank, 1, MPI_COMM_WORLD);
+				MPI_Irecv((void *)&res[rank], sizeof(CruncherResult_s), MPI_BYTE, rank, 1, MPI_COMM_WORLD, &req[rank]);
+				sent++;
+			}
+		int idx, done;
+		MPI_Testany(cpu_count, req.data(), &idx, &done, MPI_STATUS_IGNORE);
+		if (done && idx != MPI_UNDEFINED)
+			received++;
+	}
+	us = duration<double, micro>(steady_clock::now() - t).count();
+	printf("struct send %3zu+%3zu bytes   : %8.2f us/job\n", sizeof(instruction), sizeof(result), us / n_jobs);
+
+	for (int rank = 1; rank < cpu_count; rank++)
+		MPI_Send(nullptr, 0, MPI_BYTE, rank, TAG_BENCH_STOP, MPI_COMM_WORLD);
+
+	// 3) Cluster transport against the worker loop
+	cluster.initNode();
+	cluster.init();
+	Game g;
+	E_PIECE took;
+	Board child = g.current.move(str2move("e2e4"), took);
+	vector<WireJob> batch(JOB_MAX_BATCH, packJob(child, false, 0, 0));
+	for (int shm = 0; shm < 2; shm++)
+	for (int capacity = 1; capacity <= JOB_MAX_BATCH; capacity *= 2) {
+		cluster.use_shm = shm;
+		cluster.capacity = capacity;
+		cluster.messages = cluster.jobs = 0;
+		t = steady_clock::now();
+		sent = received = 0;
+		while (received < n_jobs) {
+			for (int rank = 1; rank < cpu_count && sent < n_jobs; rank++) {
+				int n = min(cluster.freeSlots(rank), n_jobs - sent);
+				if (n > 0) {
+					cluster.send(rank, batch.data(), n);
+					sent += n;
+				}
+			}
+			WireResult w;
+			int rank;
+			while (cluster.poll(w, rank))
+				received++;
+		}
+		us = duration<double, micro>(steady_clock::now() - t).count();
+		printf("%s %2zu+%2zu bytes, batch %d : %8.2f us/job, %.2f jobs/message\n", cluster.use_shm ? "shm " : "wire", sizeof(WireJob), offsetof(WireResult, pv),
+				cluster.capacity, us / n_jobs, double(cluster.jobs) / cluster.messages);
+	}
+
+	MPI_Abort(MPI_COMM_WORLD, 0);
+	return 0;
+}
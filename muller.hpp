@@ -0,0 +1,81 @@
+// Common prelude of all muller binaries: system headers, engine setup and the engine itself.
+#include <chrono>
+#include <future>
+#include <vector>
+#include <set>
+#include <list>
+#include <deque>
+#include <algorithm>
+#include <iostream>
+#include <stdint.h>
+#include <bit>
+#include <bitset>
+#include <ctime>
+#include <cassert>
+#include <iostream>
+#include <sstream>
+#include <fstream>
+#include <string>
+#include <cstring>
+#include <map>
+#include <unordered_map>
+#include <array>
+#include <atomic>
+#include <thread>
+#include <span>
+#ifndef ENG_NO_MPI
+#include <mpi.h>
+#endif
+// This line **must** come **before** including <time.h> in order to bring in
+// the POSIX functions such as `clock_gettime()`, `nanosleep()`, etc., from
+// `<time.h>`!
+//#define _POSIX_C_SOURCE 199309L
+
+// For `nanosleep()`:
+#include <time.h>
+
+
+
+using namespace std;
+using std::chrono::high_resolution_clock;
+using std::chrono::steady_clock;
+using std::chrono::duration_cast;
+using std::chrono::duration;
+using std::chrono::milliseconds;
+
+// Engine setup
+#define ENG_AB_CUT                   // Enable alpha-beta branch cut
+#define ENG_ORDER_MOVES              // Order moves for highest capture first to aid branch cuts
+#define ENG_POS_SCORE_ACCURACY 0    // Value subtracted for branch cut condition: 0=full accuracy, 100=up to a pawn loss inaccurate
+#define ENG_MOVE_DEVIATION 50       // move deviation if draw by rep is threatened
+#define ENG_DEPTH 6                  // search depth of a go without its own depth
+#define ENG_HASH_TABLES              // Transposition, killer and history tables per worker, kept between jobs and moves
+#define ENG_PST_FILE "muller.pst"    // piece-square tables read by rank 0 at startup, built-in ones if missing
+//#define ENG_STATS                  // Search counters per ply and per rank for the stats command (make muller_stats)
+//#define ENG_NNUE                   // Network eval if ENG_NNUE_FILE is there (make muller_nnue), off keeps the raw speed of the material eval
+#define ENG_NNUE_FILE "muller.nnue"  // mapped by every rank at startup
+#define ENG_TB_FILE "muller.tb"      // endgame tables, built by rank 0 if missing and mapped by every rank
+#define ENG_BOOK_KEYS_FILE "polyglot.keys" // Polyglot's Random64 numbers, needed for setoption name BookFile
+#ifdef ENG_NNUE
+#define ENG_EVAL_CACHE_BITS 16       // leaf eval cache per worker, log2 entries of 8 bytes, 0 = off
+#else
+#define ENG_EVAL_CACHE_BITS 0        // the material eval is cheaper than the cache key
+#endif
+#define ENG_PAWN_HASH_BITS 12        // pawn structure cache per worker, log2 entries of 24 bytes, 0 = off
+
+typedef uint16_t Move;
+void printMove(uint16_t m);
+std::span<const uint8_t> mapFile(const std::string &filename, size_t min_size, size_t max_size = SIZE_MAX, const char *magic = nullptr);
+void unmapFile(std::span<const uint8_t> m);
+
+int crank;
+int cpu_count;
+#ifndef ENG_NO_MPI
+MPI_Win eng_halt_win;
+#endif
+
+#include "engine.hpp"
+#include "mate.hpp"
+#include "tools.hpp"
+#include "cluster.hpp"
+#include "game.hpp"
@@ -0,0 +1,141 @@
+// Efficiently updatable network eval, built with ENG_NNUE. 768 inputs (12 pieces x 64 squares, white's view)
+// -> 256 int16 accumulator -> clipped to 0..127 -> 32 -> clipped -> 1. The accumulator of a node is its parent's
+// plus the few features the move changed, the dense layers run on int8 weights with AVX2.
+// Without a network file the classic eval is used.
+
+#include <immintrin.h>
+
+#define NNUE_FEATURES 768
+#define NNUE_HIDDEN 256
+#define NNUE_L1 32
+#define NNUE_L1_SHIFT 6     // L1 sums back to the 0..127 activation range
+#define NNUE_OUT_SCALE 16   // output units per centipawn
+
+// Layout of the network file, little endian, read in place through mmap
+struct NnueNet {
+    char magic[8];                              // "MULLNN01"
+    int16_t ft_weight[NNUE_FEATURES][NNUE_HIDDEN];
+    int16_t ft_bias[NNUE_HIDDEN];
+    int8_t l1_weight[NNUE_L1][NNUE_HIDDEN];
+    int32_t l1_bias[NNUE_L1];
+    int8_t l2_weight[NNUE_L1];
+    int32_t l2_bias;
+};
+
+struct alignas(64) Accumulator {
+    int16_t v[NNUE_HIDDEN];
+};
+
+// E_PIECE -> feature block, -1 for non pieces
+const int8_t nnue_piece[16] = {-1, 0, 1, 2, 3, 4, 5, -1, 6, 7, 8, 9, 10, 11, -1, -1};
+
+struct Nnue {
+    const NnueNet *net = nullptr;
+
+    // Maps the file read only, all ranks and threads of a node share the pages
+    bool load(const string &filename) {
+        auto m = mapFile(filename, sizeof(NnueNet), sizeof(NnueNet), "MULLNN01");
+        if (m.empty()) {
+            if (crank == 0)
+                cout << "info string " << filename << " is no network, classic eval" << endl;
+            return false;
+        }
+        net = (const NnueNet *)m.data();
+        if (crank == 0)
+            cout << "info string network from " << filename << endl;
+        return true;
+    }
+
+    static void add(int16_t *acc, const int16_t *w) {
+#if defined(__AVX512BW__)
+        for (int i = 0; i < NNUE_HIDDEN; i += 32)
+            _mm512_store_si512((__m512i *)(acc + i), _mm512_add_epi16(_mm512_load_si512((__m512i *)(acc + i)), _mm512_loadu_si512((__m512i *)(w + i))));
+#elif defined(__AVX2__)
+        for (int i = 0; i < NNUE_HIDDEN; i += 16)
+            _mm256_store_si256((__m256i *)(acc + i), _mm256_add_epi16(_mm256_load_si256((__m256i *)(acc + i)), _mm256_loadu_si256((__m256i *)(w + i))));
+#else
+        for (int i = 0; i < NNUE_HIDDEN; i++)
+            acc[i] += w[i];
+#endif
+    }
+
+    static void sub(int16_t *acc, const int16_t *w) {
+#if defined(__AVX512BW__)
+        for (int i = 0; i < NNUE_HIDDEN; i += 32)
+            _mm512_store_si512((__m512i *)(acc + i), _mm512_sub_epi16(_mm512_load_si512((__m512i *)(acc + i)), _mm512_loadu_si512((__m512i *)(w + i))));
+#elif defined(__AVX2__)
+        for (int i = 0; i < NNUE_HIDDEN; i += 16)
+            _mm256_store_si256((__m256i *)(acc + i), _mm256_sub_epi16(_mm256_load_si256((__m256i *)(acc + i)), _mm256_loadu_si256((__m256i *)(w + i))));
+#else
+        for (int i = 0; i < NNUE_HIDDEN; i++)
+            acc[i] -= w[i];
+#endif
+    }
+
+    const int16_t *feature(E_PIECE pc, int sq) { return net->ft_weight[nnue_piece[pc] * 64 + sq]; }
+
+    void refresh(Accumulator &acc, Board &b) {
+        memcpy(acc.v, net->ft_bias, sizeof(acc.v));
+        auto pcs = b.pieces_single;
+        for (uint64_t pos = b.position; pos; pos &= pos - 1) {
+            add(acc.v, feature(E_PIECE(uint8_t(pcs) & 0xF), countr_zero(pos)));
+            pcs >>= 4;
+        }
+    }
+
+    // Child accumulator from the parent's: only squares that changed occupancy, plus the target of a capture.
+    // Covers castling, en passant and promotion without knowing about them.
+    void update(Accumulator &to, const Accumulator &from, Board &before, Board &after, Move m) {
+        to = from;
+        uint64_t changed = (before.position ^ after.position) | (1ULL << move_to(m));
+        for (; changed; changed &= changed - 1) {
+            int sq = countr_zero(changed);
+            E_PIECE was = before.getPiece(sq), is = after.getPiece(sq);
+            if (was == is)
+                continue;
+            if (was != P_EMPTY)
+                sub(to.v, feature(was, sq));
+            if (is != P_EMPTY)
+                add(to.v, feature(is, sq));
+        }
+    }
+
+    // White's view in centipawns
+    int32_t evaluate(const Accumulator &acc) {
+        alignas(64) uint8_t in[NNUE_HIDDEN];
+        int32_t out = net->l2_bias;
+#if defined(__AVX2__)
+        const __m256i zero = _mm256_setzero_si256(), ones = _mm256_set1_epi16(1);
+        for (int i = 0; i < NNUE_HIDDEN; i += 32) { // packs works per 128 bit lane, the permute restores the order
+            __m256i a = _mm256_load_si256((__m256i *)(acc.v + i)), b = _mm256_load_si256((__m256i *)(acc.v + i + 16));
+            __m256i packed = _mm256_max_epi8(_mm256_packs_epi16(a, b), zero);
+            _mm256_store_si256((__m256i *)(in + i), _mm256_permute4x64_epi64(packed, 0b11011000));
+        }
+        for (int o = 0; o < NNUE_L1; o++) {
+            __m256i sum = zero;
+            for (int i = 0; i < NNUE_HIDDEN; i += 32) {
+                __m256i prod = _mm256_maddubs_epi16(_mm256_load_si256((__m256i *)(in + i)), _mm256_loadu_si256((__m256i *)(net->l1_weight[o] + i)));
+                sum = _mm256_add_epi32(sum, _mm256_madd_epi16(prod, ones));
+            }
+            __m128i s = _mm_add_epi32(_mm256_castsi256_si128(sum), _mm256_extracti128_si256(sum, 1));
+            s = _mm_hadd_epi32(s, s);
+            s = _mm_hadd_epi32(s, s);
+            int32_t l1 = (_mm_cvtsi128_si32(s) + net->l1_bias[o]) >> NNUE_L1_SHIFT;
+            out += clamp(l1, 0, 127) * net->l2_weight[o];
+        }
+#else
+        for (int i = 0; i < NNUE_HIDDEN; i++)
+            in[i] = clamp<int16_t>(acc.v[i], 0, 127);
+        for (int o = 0; o < NNUE_L1; o++) {
+            int32_t sum = net->l1_bias[o];
+            for (int i = 0; i < NNUE_HIDDEN; i++)
+                sum += in[i] * net->l1_weight[o][i];
+            out += clamp(sum >> NNUE_L1_SHIFT, 0, 127) * net->l2_weight[o];
+        }
+#endif
+        return out / NNUE_OUT_SCALE;
+    }
+} nnue;
+
+// Accumulators of the line being searched, indexed by remaining depth like the LOT
+thread_local Accumulator nnue_acc[MAX_DEPTH + 1];
@@ -0,0 +1,222 @@
+// Engine server: rank 0 hosts many games at once, one per connection to a Unix socket, and all of them share the
+// worker ranks. A connection speaks the UCI of a single game: uci, isready, position, go, stop, ponderhit,
+// ucinewgame, setoption, d and quit. "setoption name Priority value N" (1..100, default 1) weights its share.
+// The scheduler hands the free job slots out one at a time, to the session with the least worker time per
+// priority first. A session that comes back from idle starts level with the busy ones.
+// server [socket path] [max sessions]. "shutdown" from any connection stops the server.
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+struct Session {
+	int fd, number;
+	string in, out;			// unread input, unsent output
+	Game g;
+	LimitsType limits;		// in place of the globals while the session runs, see SessionScope
+	uint64_t evals = 0;
+	int priority = 1;
+	double pass = 0;		// worker ms / priority
+	uint64_t charged_ms = 0;// of g.busy_ms_total, in pass already
+	bool active = false;	// had jobs at the last schedule
+	bool eof = false;		// no more input, the session ends once its search is answered
+	bool closing = false;
+};
+
+// The session's limits, node count and output stand in for the globals of the single game UCI loop
+struct SessionScope {
+	Session &s;
+	stringstream buf;
+	streambuf *saved;
+
+	SessionScope(Session &s_) : s(s_) {
+		swap(limits, s.limits);
+		swap(evals, s.evals);
+		saved = cout.rdbuf(buf.rdbuf());
+	}
+
+	~SessionScope() {
+		cout.rdbuf(saved);
+		s.out += buf.str();
+		swap(limits, s.limits);
+		swap(evals, s.evals);
+	}
+};
+
+// false when the session ends
+bool sessionCommand(Session &s, const string &cmd, bool &stop_server) {
+	istringstream is(cmd);
+	string token;
+	is >> skipws >> token;
+	if (token == "quit" || token == "shutdown") {
+		stop_server |= token == "shutdown";
+		return false;
+	} else if (token == "stop") {
+		s.g.stopSearchMPI();
+		limits.ponder = false;
+	} else if (token == "ponderhit") {
+		limits.ponder = false;
+		limits.startTime = now();
+	} else if (token == "uci")
+		cout << "id name MULLER1 session " << s.number << "\nid author CH\n"
+			 << "option name Posscore type check default false\n"
+			 << "option name MultiPV type spin default 1 min 1 max 256\n"
+			 << "option name Priority type spin default 1 min 1 max 100\nuciok" << endl;
+	else if (token == "setoption") {
+		string name, value;
+		is >> token;
+		while (is >> token && token != "value")
+			name += (name.empty() ? "" : " ") + token;
+		is >> value;
+		if (name == "Priority")
+			s.priority = clamp(atoi(value.c_str()), 1, 100);
+		else if (name == "BookFile" || name == "JobBatch" || name == "Threads" || name == "EvalCacheBits" || name == "PawnHashBits")
+			cout << "info string " << name << " is shared by all sessions, set it before server" << endl;
+		else {
+			istringstream option(cmd.substr(cmd.find("setoption") + 9));
+			UCIsetoption(option);
+		}
+	} else if (token == "go")
+		UCIgo(s.g, is);
+	else if (token == "position")
+		UCIposition(s.g, is);
+	else if (token == "ucinewgame") { // tables on the workers are shared, they are not cleared for one session
+		s.g.stopSearchMPI();
+		s.g.subtree_owner.clear();
+	} else if (token == "isready")
+		cout << "readyok" << endl;
+	else if (token == "d")
+		s.g.current.print(s.g.checkRepetition());
+	else if (!token.empty())
+		cout << "Unknown command: " << cmd << endl;
+	return true;
+}
+
+// Free slots one at a time to the session lowest in pass, counting what it got this round at its mean job time
+void schedule(list<unique_ptr<Session>> &sessions) {
+	double floor = numeric_limits<double>::max();
+	for (auto &s : sessions)
+		if (s->active)
+			floor = min(floor, s->pass);
+	for (auto &s : sessions) {
+		bool work = !s->g.searchq.empty();
+		if (work && !s->active && floor != numeric_limits<double>::max())
+			s->pass = max(s->pass, floor);
+		s->active = work;
+	}
+	int free = 0;
+	for (int rank = 1; rank < cpu_count; rank++)
+		free += max(0, cluster.freeSlots(rank));
+	unordered_map<Session *, int> queued, alloc;
+	for (auto &s : sessions)
+		queued[s.get()] = count_if(s->g.searchq.begin(), s->g.searchq.end(), [](auto &sr) { return sr.rank == 0; });
+	for (; free > 0; free--) {
+		Session *pick = nullptr;
+		double best = 0;
+		for (auto &s : sessions) {
+			Session *p = s.get();
+			if (alloc[p] >= queued[p])
+				continue;
+			double mean = double(p->g.busy_ms_total + 1) / (p->g.jobs_total + 1);
+			double v = p->pass + alloc[p] * mean / p->priority;
+			if (!pick || v < best)
+				pick = p, best = v;
+		}
+		if (!pick)
+			break;
+		alloc[pick]++;
+	}
+	for (auto &s : sessions) {
+		SessionScope scope(*s);
+		bool new_result = s->g.processSearchQ(alloc[s.get()]);
+		s->pass += double(s->g.busy_ms_total - s->charged_ms) / s->priority;
+		s->charged_ms = s->g.busy_ms_total;
+		if (evals > 0 && new_result && !limits.ponder && !UCIreport(s->g))
+			cout << "bestmove 0000" << endl; // mate or stale
+	}
+}
+
+void runServer(const string &path, int max_sessions) {
+	int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+	sockaddr_un addr{};
+	addr.sun_family = AF_UNIX;
+	strncpy(addr.sun_path, path.c_str(), sizeof(addr.sun_path) - 1);
+	unlink(path.c_str());
+	if (listener < 0 || bind(listener, (sockaddr *)&addr, sizeof(addr)) < 0 || listen(listener, 16) < 0) {
+		cout << "info string can't listen on " << path << endl;
+		if (listener >= 0)
+			close(listener);
+		return;
+	}
+	fcntl(listener, F_SETFL, O_NONBLOCK);
+	cout << "info string server on " << path << " with " << cpu_count - 1 << " workers" << endl;
+	list<unique_ptr<Session>> sessions;
+	LimitsType defaults = limits;
+	bool stop_server = false;
+	int connections = 0;
+	while (!stop_server || !sessions.empty()) {
+		bool idle = true;
+		int fd;
+		while (!stop_server && (fd = accept(listener, nullptr, nullptr)) >= 0) {
+			if (int(sessions.size()) >= max_sessions) {
+				const char full[] = "info string server full\n";
+				send(fd, full, sizeof(full) - 1, MSG_NOSIGNAL);
+				close(fd);
+				continue;
+			}
+			fcntl(fd, F_SETFL, O_NONBLOCK);
+			auto s = make_unique<Session>();
+			s->fd = fd;
+			s->number = ++connections;
+			s->limits = defaults;
+			s->g.reporting = true;
+			cout << "info string session " << s->number << " connected" << endl;
+			sessions.push_back(move(s));
+		}
+		for (auto &s : sessions) {
+			char buf[4096];
+			ssize_t n;
+			while ((n = recv(s->fd, buf, sizeof(buf), MSG_DONTWAIT)) > 0)
+				s->in.append(buf, n);
+			s->eof |= n == 0;
+			s->closing |= n < 0 && errno != EAGAIN && errno != EWOULDBLOCK;
+			for (size_t nl; !s->closing && (nl = s->in.find('\n')) != string::npos;) {
+				string cmd = s->in.substr(0, nl);
+				s->in.erase(0, nl + 1);
+				if (!cmd.empty() && cmd.back() == '\r')
+					cmd.pop_back();
+				SessionScope scope(*s);
+				s->closing = !sessionCommand(*s, cmd, stop_server);
+				idle = false;
+			}
+		}
+		schedule(sessions);
+		for (auto it = sessions.begin(); it != sessions.end();) {
+			auto &s = **it;
+			if (!s.out.empty()) {
+				ssize_t n = send(s.fd, s.out.data(), s.out.size(), MSG_DONTWAIT | MSG_NOSIGNAL);
+				if (n > 0) {
+					s.out.erase(0, n);
+					idle = false;
+				}
+			}
+			if (s.closing || stop_server || (s.eof && s.in.find('\n') == string::npos && s.g.searchq.empty() && s.out.empty())) {
+				{
+					SessionScope scope(s);
+					s.g.stopSearchMPI();
+				}
+				if (!s.out.empty()) // last words, best effort
+					send(s.fd, s.out.data(), s.out.size(), MSG_DONTWAIT | MSG_NOSIGNAL);
+				close(s.fd);
+				cout << "info string session " << s.number << " closed" << endl;
+				it = sessions.erase(it);
+			} else
+				++it;
+		}
+		if (idle)
+			sleep_us(50);
+	}
+	close(listener);
+	unlink(path.c_str());
+}
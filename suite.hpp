@@ -0,0 +1,102 @@
+// EPD test suites. Every position is a whole position job, so the workers solve the suite in parallel and
+// rank 0 only hands out positions and checks the answers.
+// epd <file> [depth N | movetime ms | N]: solved means the move is one of bm and none of am.
+
+struct EpdPosition {
+	string fen, id;
+	vector<string> bm, am;
+};
+
+// SAN without check marks and annotations, "Nf3+" and "Nf3!" both match "Nf3"
+string sanBare(string s) {
+	while (!s.empty() && strchr("+#!?", s.back()))
+		s.pop_back();
+	return s;
+}
+
+// One EPD or FEN line, false if it holds no position. The id stays empty if the line has none.
+bool parseEpd(const string &line, EpdPosition &p) {
+	istringstream is(line);
+	string field, fen;
+	for (int i = 0; i < 4 && is >> field; i++)
+		fen += (i ? " " : "") + field;
+	if (count(fen.begin(), fen.end(), ' ') < 3 || fen[0] == '#')
+		return false;
+	p = {fen + " 0 1", "", {}, {}};
+	string rest;
+	getline(is, rest);
+	istringstream ops(rest);
+	string op;
+	while (getline(ops, op, ';')) {
+		istringstream os(op);
+		string code, operand;
+		os >> code;
+		while (os >> operand) {
+			if (code == "bm")
+				p.bm.push_back(sanBare(operand));
+			else if (code == "am")
+				p.am.push_back(sanBare(operand));
+			else if (code == "id")
+				p.id += (p.id.empty() ? "" : " ") + operand;
+		}
+	}
+	p.id.erase(remove(p.id.begin(), p.id.end(), '"'), p.id.end());
+	return true;
+}
+
+vector<EpdPosition> readEpd(const string &filename) {
+	vector<EpdPosition> suite;
+	ifstream in(filename);
+	string line;
+	EpdPosition p;
+	while (getline(in, line))
+		if (parseEpd(line, p)) {
+			if (p.id.empty())
+				p.id = to_string(suite.size() + 1);
+			suite.push_back(p);
+		}
+	return suite;
+}
+
+void runEpd(const string &filename, int depth, uint32_t movetime) {
+	auto suite = readEpd(filename);
+	if (suite.empty()) {
+		cout << "info string no positions in " << filename << endl;
+		return;
+	}
+	vector<Game> games;
+	RootSearch rs;
+	for (size_t i = 0; i < suite.size(); i++) {
+		games.emplace_back(suite[i].fen);
+		if (!games.back().getValidMoves().empty())
+			rs.submit(games.back().current, games.back().white_to_move, depth, movetime, 0, i, limits.pos_score_enabled);
+	}
+	int solved = 0, done = 0;
+	uint64_t nodes = 0, job_ms = 0;
+	auto t_start = now();
+	RootResult r;
+	while (rs.pending()) {
+		if (!rs.poll(r)) {
+			sleep_us(50);
+			continue;
+		}
+		auto &p = suite[r.tag];
+		auto &g = games[r.tag];
+		string found = r.best.move ? sanBare(Game::san(g.current, g.white_to_move, r.best.move)) : "-";
+		bool ok = (p.bm.empty() || find(p.bm.begin(), p.bm.end(), found) != p.bm.end()) && find(p.am.begin(), p.am.end(), found) == p.am.end();
+		solved += ok;
+		done++;
+		nodes += r.evals;
+		job_ms += r.ms_taken;
+		cout << "info string epd " << done << "/" << suite.size() << " " << p.id << (ok ? " solved " : " failed ") << found;
+		for (auto &m : p.bm)
+			cout << (&m == &p.bm[0] ? " bm " : " ") << m;
+		for (auto &m : p.am)
+			cout << (&m == &p.am[0] ? " am " : " ") << m;
+		cout << " score " << r.best.score << " depth " << r.depth << " nodes " << r.evals << " time " << r.ms_taken << endl;
+	}
+	uint64_t ms = since(t_start);
+	cout << "info string epd solved " << solved << "/" << suite.size() << " in " << ms << " ms, " << (job_ms / max(1, done))
+		 << " ms per position, " << (done * 1000.0 / (ms + 1)) << " positions/s, " << nodes << " nodes, " << nodes * 1000 / (ms + 1) << " nps" << endl;
+	ResetStats();
+}
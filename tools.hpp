@@ -1,3 +1,7 @@
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
 
 enum SyncCout { IO_LOCK, IO_UNLOCK };
 std::ostream& operator<<(std::ostream&, SyncCout);
@@ -53,6 +57,32 @@ void sleep_ms(unsigned long milliseconds) {
 	sleep_us(milliseconds * 1000);
 }
 
+// Maps a file read only, all ranks and threads of a node share the pages. Empty if it can't be mapped, its size is
+// not within min_size..max_size or it does not start with the 8 byte magic.
+span<const uint8_t> mapFile(const string &filename, size_t min_size, size_t max_size, const char *magic) {
+    int fd = ::open(filename.c_str(), O_RDONLY);
+    if (fd < 0)
+        return {};
+    struct stat st;
+    void *p = MAP_FAILED;
+    if (fstat(fd, &st) == 0 && size_t(st.st_size) >= max<size_t>(min_size, 1) && size_t(st.st_size) <= max_size)
+        p = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (p == MAP_FAILED)
+        return {};
+    span<const uint8_t> m((const uint8_t *)p, st.st_size);
+    if (magic && (m.size() < 8 || memcmp(m.data(), magic, 8))) {
+        unmapFile(m);
+        return {};
+    }
+    return m;
+}
+
+void unmapFile(span<const uint8_t> m) {
+    if (!m.empty())
+        munmap((void *)m.data(), m.size());
+}
+
 // simple helpers
 uint16_t str2move(string move) {
     uint16_t result = 0;
@@ -92,31 +122,34 @@ void printMove(EvalResult m) {
     	if (m.lot[j] == 0xFFEE) {
     		cout << "ERR";break;
     	}
+    	if (m.lot[j] == 0xFFDD) {
+    		cout << "REP";break;
+    	}
+    	if (m.lot[j] == 0xFFCC) {
+    		cout << "TB";break;
+    	}
     	printMove(m.lot[j]);
     }
     cout << "] ";
 }
 
-void printMoveUCI(EvalResult m, int time_spent_ms) {
+// multipv 0 leaves the field out, the pv stops at the end marks of the LOT and shows TB for the tables
+void printMoveUCI(EvalResult m, int depth, const string &score, int time_spent_ms, int multipv = 0) {
     // info depth 6 seldepth 4 multipv 1 score cp 59 nodes 489 nps 244500 hashfull 0 tbhits 0 time 2 pv g1f3 d7d5 d2d4
 
-	cout << "info depth " << limits.depth << " score cp " << m.score << " nodes " << evals << " nps " << (evals / time_spent_ms) * 1000 << " time " << time_spent_ms << " pv ";
+	cout << "info depth " << depth;
+	if (multipv)
+		cout << " multipv " << multipv;
+	cout << " score " << score << " nodes " << evals << " nps " << (evals / time_spent_ms) * 1000 << " time " << time_spent_ms << " pv ";
 	int d = MAX_DEPTH - 1;
 	while(m.lot[d] == 0 && d > 0) d--;
 	printMove(m.move);
-    for (int j = d-1; j > 0; j--) {
-    	if (m.lot[j] == 0) {
-    		cout << "MATE";break;
-    	}
-    	if (m.lot[j] == 0xFFFF) {
-    		cout << "STALE";break;
-    	}
-    	if (m.lot[j] == 0xFFEE) {
-    		cout << "ERR";break;
-    	}
-    	printMove(m.lot[j]);
-    }
-    cout << "\n";
+	int j = d-1;
+	for (; j > 0 && m.lot[j] != 0 && m.lot[j] < 0xFFCC; j--)
+		printMove(m.lot[j]);
+	if (j > 0 && m.lot[j] == 0xFFCC) // the line ends in the endgame tables
+		cout << "TB";
+	cout << "\n";
 }
 
 E_PIECE charToPiece(unsigned char c) {
@@ -0,0 +1,159 @@
+// Training data for eval tuning: every searched position of the datagen self-play games as a fixed size record,
+// the 24 byte Board core plus what the search and the game said about it. Records go to chunk files through a
+// writer thread, a chunk is renamed into place once it is complete. TrainingFile maps a chunk read only, the
+// records are used in place.
+
+#include <mutex>
+#include <condition_variable>
+
+#define TRAINING_MAGIC "MULLTD01"
+
+struct TrainingRecord {
+	uint64_t pieces[2];		// Board::pieces, 4 bit per piece in position order
+	uint64_t position;		// Board::position
+	int32_t score;			// search score for the side to move
+	int8_t result;			// game result for the side to move: 1 win, 0 draw, -1 loss
+	uint8_t white_to_move;
+	uint8_t enpassant_square;
+	uint8_t castling;		// game_flags bits W_CK_BIT..B_CQ_BIT
+};
+static_assert(sizeof(TrainingRecord) == 32, "TrainingRecord should be 32 bytes");
+
+struct TrainingHeader {
+	char magic[8];
+	uint32_t record_size;
+	uint32_t records;
+};
+
+TrainingRecord packTraining(const Board &b, bool white, int32_t score) {
+	return {{b.pieces[0], b.pieces[1]}, b.position, score, 0, white, uint8_t(b.enpassant_square), uint8_t(b.game_flags & 0xF)};
+}
+
+Board unpackTraining(const TrainingRecord &r) {
+	Board b;
+	b.pieces[0] = r.pieces[0];
+	b.pieces[1] = r.pieces[1];
+	b.position = r.position;
+	b.enpassant_square = r.enpassant_square;
+	b.game_flags = r.castling;
+	b.pst_score = b.pstScore();
+	return b;
+}
+
+// prefix.00000.bin, prefix.00001.bin, ... with chunk_records records each, the last one may be shorter
+struct TrainingWriter {
+	string prefix;
+	size_t chunk_records;
+	mutex mtx;
+	condition_variable cv;
+	deque<vector<TrainingRecord>> queue;
+	bool done = false;
+	thread writer;
+	uint64_t written = 0;
+	int chunks = 0;
+
+	TrainingWriter(const string &prefix_, size_t chunk_records_) : prefix(prefix_), chunk_records(max<size_t>(1, chunk_records_)) {
+		writer = thread([this]() { run(); });
+	}
+
+	~TrainingWriter() { finish(); }
+
+	// Writes what is queued and closes the last chunk
+	void finish() {
+		if (!writer.joinable())
+			return;
+		{
+			lock_guard<mutex> lock(mtx);
+			done = true;
+		}
+		cv.notify_one();
+		writer.join();
+	}
+
+	void push(vector<TrainingRecord> &&records) {
+		{
+			lock_guard<mutex> lock(mtx);
+			queue.push_back(move(records));
+		}
+		cv.notify_one();
+	}
+
+	string chunkName(int n) {
+		char num[8];
+		snprintf(num, sizeof(num), "%05d", n);
+		return prefix + "." + num + ".bin";
+	}
+
+	void run() {
+		ofstream out;
+		string tmp;
+		uint32_t in_chunk = 0;
+		auto close = [&]() {
+			TrainingHeader h{};
+			memcpy(h.magic, TRAINING_MAGIC, 8);
+			h.record_size = sizeof(TrainingRecord);
+			h.records = in_chunk;
+			out.seekp(0);
+			out.write((const char *)&h, sizeof(h));
+			out.close();
+			rename(tmp.c_str(), chunkName(chunks++).c_str());
+			in_chunk = 0;
+		};
+		while (true) {
+			vector<TrainingRecord> records;
+			{
+				unique_lock<mutex> lock(mtx);
+				cv.wait(lock, [this]() { return done || !queue.empty(); });
+				if (queue.empty())
+					break;
+				records = move(queue.front());
+				queue.pop_front();
+			}
+			for (size_t i = 0; i < records.size();) {
+				if (!out.is_open()) {
+					tmp = chunkName(chunks) + ".tmp";
+					out.open(tmp, ios::binary);
+					TrainingHeader h{};
+					out.write((const char *)&h, sizeof(h)); // filled in when the chunk is closed
+				}
+				size_t n = min(records.size() - i, chunk_records - in_chunk);
+				out.write((const char *)&records[i], n * sizeof(TrainingRecord));
+				i += n;
+				in_chunk += n;
+				written += n;
+				if (in_chunk == chunk_records)
+					close();
+			}
+		}
+		if (out.is_open())
+			close();
+	}
+};
+
+struct TrainingFile {
+	const uint8_t *data = nullptr;
+	size_t size = 0;
+	const TrainingRecord *records = nullptr;
+	size_t n = 0;
+
+	bool open(const string &filename) {
+		auto m = mapFile(filename, sizeof(TrainingHeader), SIZE_MAX, TRAINING_MAGIC);
+		if (m.empty())
+			return false;
+		auto h = (const TrainingHeader *)m.data();
+		if (h->record_size != sizeof(TrainingRecord) || sizeof(TrainingHeader) + size_t(h->records) * sizeof(TrainingRecord) > m.size()) {
+			unmapFile(m);
+			return false;
+		}
+		data = m.data();
+		size = m.size();
+		records = (const TrainingRecord *)(data + sizeof(TrainingHeader));
+		n = h->records;
+		return true;
+	}
+
+	~TrainingFile() { unmapFile({data, size}); }
+
+	const TrainingRecord *begin() const { return records; }
+	const TrainingRecord *end() const { return records + n; }
+};
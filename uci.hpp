@@ -57,17 +57,19 @@ string UCImove(Game &g, Move m, bool chess960) {
 /// UCI::to_move() converts a string representing a move in coordinate notation
 /// (g1f3, a7a8q) to the corresponding legal Move, if any.
 
-Move UCIto_move(Game& g, string& str) {
+/// Promotions are always to a queen, the encoded move has no room for the piece.
 
-  if (str.length() == 5) // Junior could send promotion piece in uppercase
-      str[4] = char(tolower(str[4]));
+bool UCIis_move(const string& str) {
+  return str.length() >= 4 && str[0] >= 'a' && str[0] <= 'h' && str[1] >= '1' && str[1] <= '8'
+                           && str[2] >= 'a' && str[2] <= 'h' && str[3] >= '1' && str[3] <= '8';
+}
 
-  auto valid_moves = g.getValidMoves();
-  for (const auto& m : valid_moves)
-      if (str == UCImove(g, m, false))
-          return m;
+Move UCIto_move(Game& g, string& str) {
 
-  return 0;
+  if (!UCIis_move(str))
+      return 0;
+  Move m = str2move(str);
+  return g.isValidMove(m) ? m : 0;
 }
 
 
@@ -83,7 +85,6 @@ const char* StartFEN = "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1
 
   void UCIposition(Game& pos, istringstream& is) {
 
-    Move m;
     string token, fen;
 
     is >> token;
@@ -99,12 +100,11 @@ const char* StartFEN = "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1
     else
         return;
 
-    pos.setFEN(fen);
-
-    // Parse move list (if any)
-    while (is >> token && (m = UCIto_move(pos, token)) != 0) {
-    	pos.execMove(m);
-    }
+    // Parse move list (if any), the game plays what is new
+    vector<Move> moves;
+    while (is >> token && UCIis_move(token))
+        moves.push_back(str2move(token));
+    pos.setPosition(fen, moves);
   }
 
 
@@ -124,8 +124,20 @@ const char* StartFEN = "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1
     // Read option value (can contain spaces)
     while (is >> token)
         value += (value.empty() ? "" : " ") + token;
-    if (name == "posscore")
+    if (name == "posscore" || name == "Posscore")
     	limits.pos_score_enabled = value == "true";
+    if (name == "EvalCacheBits")
+    	limits.eval_cache_bits = stoi(value) ? clamp(stoi(value), 10, 24) : 0;
+    if (name == "PawnHashBits")
+    	limits.pawn_hash_bits = stoi(value) ? clamp(stoi(value), 8, 22) : 0;
+    if (name == "BookFile")
+    	book.open(value);
+    if (name == "MultiPV")
+    	limits.multipv = clamp(stoi(value), 1, 256);
+    if (name == "JobBatch")
+    	cluster.capacity = clamp(stoi(value), 1, JOB_MAX_BATCH);
+    if (name == "Threads" && cluster.threaded)
+    	cluster.startThreads(max(1, stoi(value)));
     //cout << name << "=" << token << endl;
     Options[name] = value;
   }
@@ -143,6 +155,13 @@ const char* StartFEN = "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1
     bool ponderMode = false;
 
     limits.startTime = now(); // As early as possible!
+    // what go sets holds for this go only, the options stay
+    limits.searchmoves.clear();
+    limits.time[WHITE] = limits.time[BLACK] = limits.inc[WHITE] = limits.inc[BLACK] = 0;
+    limits.movestogo = limits.movetime = limits.perft = limits.infinite = limits.mate_search = 0;
+    limits.nodes = 0;
+    limits.depth = ENG_DEPTH;
+    limits.ponder = false;
 
     while (is >> token)
         if (token == "searchmoves")
@@ -162,10 +181,254 @@ const char* StartFEN = "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1
         else if (token == "infinite")  limits.infinite = 1;
         else if (token == "ponder")    ponderMode = true;
     //limits.depth += 5;
-    pos.startSearchMPI(limits.depth);
+    // While pondering the search runs as usual, only bestmove is held back until ponderhit or stop
+    limits.ponder = ponderMode;
+    // a book move needs no search, while pondering the GUI waits for ponderhit first
+    if (!ponderMode && !limits.mate_search && !limits.perft && limits.searchmoves.empty()) {
+        Move m = book.probe(pos.current, pos.white_to_move);
+        if (m && pos.isValidMove(m)) {
+            cout << "bestmove " << pos.current.move2str(m) << endl;
+            return;
+        }
+    }
+    // mate N needs 2N plies, the line of a longer mate is cut to the LOT
+    pos.startSearchMPI(limits.mate_search ? min(2 * limits.mate_search, MAX_DEPTH - 1) : limits.depth);
     //Threads.start_thinking(pos, states, limits, ponderMode);
   }
 
+  // bench [depth] [ranks] searches a fixed set of positions to the depth. Every job starts with empty tables,
+  // so the node counts and the signature only change when the search does, whatever the number of ranks.
+  const vector<string> BenchFENs = {
+    "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1",
+    "r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq - 0 1",
+    "r1bq1rk1/pp2bppp/2n2n2/3p4/3P4/2NB1N2/PP3PPP/R1BQ1RK1 w - - 0 9",
+    "r2q1rk1/pb1nbppp/1p2pn2/2pp4/2PP4/1PN1PN2/PB2BPPP/R2Q1RK1 b - - 0 10",
+    "8/2p5/3p4/KP5r/1R3p1k/8/4P1P1/8 w - - 0 1",
+    "6k1/5ppp/8/8/8/8/5PPP/3R2K1 w - - 0 1",
+    "3k4/8/2K5/2B5/2B5/8/8/8 w - - 0 1",  // mate in 11
+    "3nk3/8/3B1K2/8/8/6Q1/8/8 w - - 0 1", // mate in 5
+    "8/1k6/3R4/3K4/8/5n2/8/8 w - - 0 1",  // mate in 15
+  };
+
+  void UCIbench(istringstream& is) {
+    int depth = 5, ranks = 0;
+    is >> depth >> ranks;
+    int saved_count = cpu_count;
+    if (ranks > 0 && cluster.threaded)
+        cluster.startThreads(ranks);
+    else if (ranks > 0) // the ranks above stay idle
+        cpu_count = min(cpu_count, ranks + 1);
+    int workers = cpu_count - 1;
+    cluster.fresh_tables = true;
+    uint64_t total_nodes = 0, signature = 14695981039346656037ULL; // FNV-1a over the node counts
+    auto t_start = now();
+    for (size_t i = 0; i < BenchFENs.size(); i++) {
+        Game g(BenchFENs[i]);
+        g.startSearchMPI(depth);
+        while (!g.processSearchQ())
+            sleep_us(50);
+        auto best = *max_element(g.last_search_result.begin(), g.last_search_result.end());
+        uint64_t ms = since(g.last_search_start);
+        cout << "bench " << i + 1 << "/" << BenchFENs.size() << " depth " << depth << " nodes " << evals << " time " << ms
+             << " nps " << evals * 1000 / (ms + 1) << " bestmove " << g.current.move2str(best.move) << endl;
+        total_nodes += evals;
+        signature = (signature ^ evals) * 1099511628211ULL;
+    }
+    uint64_t ms = since(t_start);
+    cluster.fresh_tables = false;
+    if (ranks > 0 && cluster.threaded)
+        cluster.startThreads(saved_count - 1);
+    else
+        cpu_count = saved_count;
+    cout << "===========================\nTotal time (ms) : " << ms << "\nNodes searched  : " << total_nodes
+         << "\nNodes/second    : " << total_nodes * 1000 / (ms + 1) << "\nSignature       : " << hex << signature << dec << "\nWorkers         : " << workers << endl;
+    ResetStats();
+  }
+
+  // epd <file> [depth N | movetime ms | N], a bare number is the depth. movetime alone deepens as far as it gets.
+  void UCIepd(istringstream& is) {
+    string file, token;
+    int depth = 0;
+    uint32_t movetime = 0;
+    is >> file;
+    while (is >> token)
+        if (token == "depth")         is >> depth;
+        else if (token == "movetime") is >> movetime;
+        else if (isdigit(token[0]))   depth = stoi(token);
+    runEpd(file, depth ? depth : movetime ? MAX_DEPTH - 1 : limits.depth, movetime);
+  }
+
+  // match [games N] [openings file] [pgn file] [sprt elo0 elo1] [movetime 100] [b.posscore 0] ..., see match.hpp
+  void UCImatch(istringstream& is, TrainingWriter *data = nullptr) {
+    MatchConfig mc;
+    mc.data = data;
+    string token;
+    mc.side[0].pos_score = mc.side[1].pos_score = limits.pos_score_enabled;
+    while (is >> token) {
+        if (token == "games")            is >> mc.games;
+        else if (token == "concurrency") is >> mc.concurrency;
+        else if (token == "openings")    is >> mc.openings;
+        else if (token == "random")      is >> mc.random_plies;
+        else if (token == "maxplies")    is >> mc.max_plies;
+        else if (token == "pgn")         is >> mc.pgn;
+        else if (token == "sprt")        is >> mc.elo0 >> mc.elo1, mc.sprt = true;
+        else if (token == "alpha")       is >> mc.alpha;
+        else if (token == "beta")        is >> mc.beta;
+        else { // per side with an a. or b. in front, both sides without
+            int first = 0, last = 1;
+            if (token.size() > 2 && (token[0] == 'a' || token[0] == 'b') && token[1] == '.') {
+                first = last = token[0] == 'b';
+                token = token.substr(2);
+            }
+            uint32_t value;
+            if (!(is >> value))
+                break;
+            for (int i = first; i <= last; i++)
+                if (token == "depth")         mc.side[i].depth = value;
+                else if (token == "movetime") mc.side[i].movetime = value;
+                else if (token == "nodes")    mc.side[i].nodes = value;
+                else if (token == "posscore") mc.side[i].pos_score = value;
+        }
+    }
+    runMatch(mc);
+  }
+
+  // datagen [games N] [out prefix] [chunk records] [depth|movetime|nodes V] [openings file] [random plies] ...
+  // self-play of one setting against itself, the options of match apply
+  void UCIdatagen(istringstream& is) {
+    string prefix = "muller_data", rest, token;
+    size_t chunk = 1 << 20;
+    while (is >> token)
+        if (token == "out")        is >> prefix;
+        else if (token == "chunk") is >> chunk;
+        else                       rest += token + " ";
+    TrainingWriter writer(prefix, chunk);
+    istringstream match_is(rest);
+    UCImatch(match_is, &writer);
+    writer.finish();
+    cout << "info string " << writer.written << " positions in " << writer.chunks << " chunks " << prefix << ".*.bin" << endl;
+  }
+
+  // datastat <chunk files>: what the reader finds in datagen output
+  void UCIdatastat(istringstream& is) {
+    string file;
+    uint64_t n = 0, results[3] = {}, white = 0, decisive_scores = 0, eval_agrees = 0;
+    while (is >> file) {
+        TrainingFile f;
+        if (!f.open(file)) {
+            cout << "info string no training data in " << file << endl;
+            continue;
+        }
+        for (auto &r : f) {
+            results[r.result + 1]++;
+            white += r.white_to_move;
+            decisive_scores += abs(r.score) >= INT32_MAX / 4;
+            if (r.result) {
+                Board b = unpackTraining(r);
+                int32_t e = b.eval();
+                eval_agrees += (r.white_to_move ? e : -e) * r.result > 0;
+            }
+        }
+        n += f.n;
+    }
+    cout << "info string " << n << " positions, side to move won " << results[2] << " drew " << results[1] << " lost " << results[0]
+         << ", white to move " << white << ", mate and table scores " << decisive_scores << ", static eval agrees with "
+         << (100 * eval_agrees) / max<uint64_t>(1, results[0] + results[2]) << "% of the decided" << endl;
+  }
+
+  // analyze [file | -] [depth N | movetime ms | nodes N] [inflight N] [binary] [out file], see analyze.hpp
+  void UCIanalyze(istringstream& is) {
+    string file = "-", out_file, token;
+    int depth = 0, inflight = 0;
+    uint32_t movetime = 0, nodes = 0;
+    bool binary = false;
+    while (is >> token)
+        if (token == "depth")         is >> depth;
+        else if (token == "movetime") is >> movetime;
+        else if (token == "nodes")    is >> nodes;
+        else if (token == "inflight") is >> inflight;
+        else if (token == "binary")   binary = true;
+        else if (token == "out")      is >> out_file;
+        else                          file = token;
+    ifstream in_f;
+    ofstream out_f;
+    if (file != "-")
+        in_f.open(file);
+    if (!out_file.empty())
+        out_f.open(out_file, binary ? ios::binary : ios::out);
+    runAnalyze(file != "-" ? in_f : cin, out_file.empty() ? cout : out_f, binary,
+               depth ? depth : movetime || nodes ? MAX_DEPTH - 1 : limits.depth, movetime, nodes, inflight);
+  }
+
+#ifdef ENG_STATS
+// Search counters of all ranks since the start or the last stats reset. The effective branching factor of a ply is
+// its nodes over the nodes of the ply above, the one of the search is the geometric mean down to the deepest ply.
+void printSearchStats() {
+    SearchStats total{};
+    for (auto &r : cluster.rank_stats)
+        total.add(r);
+    int first = 0, last = MAX_DEPTH;
+    while (first < MAX_DEPTH && !total.nodes[first]) first++;
+    while (last > first && !total.nodes[last]) last--;
+    uint64_t nodes = 0;
+    for (int ply = first; ply <= last; ply++) {
+        nodes += total.nodes[ply];
+        cout << "info string stats ply " << ply << " nodes " << total.nodes[ply];
+        if (ply > first)
+            cout << " ebf " << round(100.0 * total.nodes[ply] / total.nodes[ply - 1]) / 100;
+        cout << endl;
+    }
+    double ebf = last > first ? pow(double(total.nodes[last]) / total.nodes[first], 1.0 / (last - first)) : 0;
+    cout << "info string stats nodes " << nodes << " ebf " << round(100 * ebf) / 100 << " cuts " << total.cuts
+         << " first move " << (100 * total.first_cuts) / max<uint64_t>(1, total.cuts) << "% average index "
+         << round(100.0 * total.cut_index / max<uint64_t>(1, total.cuts)) / 100 << " null windows " << total.null_windows
+         << " researched " << total.researches << " (" << (100 * total.researches) / max<uint64_t>(1, total.null_windows) << "%)" << endl;
+    for (int rank = 1; rank < int(cluster.rank_stats.size()); rank++) {
+        auto &r = cluster.rank_stats[rank];
+        uint64_t n = 0;
+        for (auto x : r.nodes)
+            n += x;
+        cout << "info string stats rank " << rank << " nodes " << n << " cuts " << r.cuts << " first move "
+             << (100 * r.first_cuts) / max<uint64_t>(1, r.cuts) << "% researched " << r.researches << endl;
+    }
+}
+#endif
+
+// stats [reset], needs a build with ENG_STATS
+void UCIstats(istringstream& is) {
+#ifdef ENG_STATS
+    string token;
+    if (is >> token && token == "reset")
+        cluster.rank_stats.assign(cluster.rank_stats.size(), {});
+    else
+        printSearchStats();
+#else
+    (void)is;
+    cout << "info string search statistics need a build with ENG_STATS (make muller_stats)" << endl;
+#endif
+}
+
+// Result of a finished search and its bestmove, false if there is no move (mate or stale)
+bool UCIreport(Game &g) {
+    g.printLines(g.last_search_ms+1);
+    auto move = g.selectMove(g.last_search_result);
+    if (move.move == 0)
+        return false;
+    // info depth 6 seldepth 4 multipv 1 score cp 59 nodes 489 nps 244500 hashfull 0 tbhits 0 time 2 pv g1f3 d7d5 d2d4
+    // bestmove g1f3 ponder d7d5
+    cout << "bestmove " << g.current.move2str(move.move);
+    Move reply = g.last_search_depth > 1 ? move.lot[g.last_search_depth - 1] : 0;
+    if (reply != 0 && reply < 0xFFCC) { // expected answer from the PV, the GUI lets us search it on its time
+        E_PIECE took;
+        cout << "ponder " << g.current.move(move.move, took).move2str(reply);
+    }
+    cout << endl;
+    ResetStats();
+    return true;
+}
+
+void runServer(const string &path, int max_sessions);
+
 /// UCI::loop() waits for a command from stdin, parses it and calls the appropriate
 /// function. Also intercepts EOF from stdin to ensure gracefully exiting if the
 /// GUI dies unexpectedly. When called with some command line arguments, e.g. to
@@ -184,27 +447,25 @@ void UCIloop(int argc, char* argv[]) {
       cmd += std::string(argv[i]) + " ";
 
   limits.pos_score_enabled = true;
+  limits.eval_cache_bits = ENG_EVAL_CACHE_BITS;
+  limits.pawn_hash_bits = ENG_PAWN_HASH_BITS;
   Game g = Game();
-  limits.depth = 6;
-  auto future = async(launch::async, GetLineSync);
+  limits.depth = ENG_DEPTH;
+  limits.multipv = 1;
+  g.reporting = true;
+  future<string> future; // stdin is only read without command line arguments, the reader would block the exit
+  if (argc == 1)
+      future = async(launch::async, GetLineSync);
 
   do {
 	  bool new_result = g.processSearchQ();
-	  if (evals > 0 && new_result) {
-	      for (auto r : g.last_search_result)
-	    	  printMoveUCI(r, g.last_search_ms+1);
-		  auto move = g.selectMove(g.last_search_result);
-	      if (move.move == 0)
-	        	break; // mate or stale
-	      // info depth 6 seldepth 4 multipv 1 score cp 59 nodes 489 nps 244500 hashfull 0 tbhits 0 time 2 pv g1f3 d7d5 d2d4
-	      // bestmove g1f3 ponder d7d5
-	      //cout << g.last_search_ms << endl;
-	      cout << "bestmove " << g.current.move2str(move.move) << endl;
-	      ResetStats();
-	  }
+	  if (evals > 0 && new_result && !limits.ponder && !UCIreport(g))
+	      break; // mate or stale
       if (argc == 1) {
     	cmd.clear();
-   		if (future.wait_for(chrono::milliseconds(5)) == future_status::ready) {
+   		// while a search runs, poll fast so finished ranks get their next jobs without delay
+   		auto poll = g.searchq.empty() ? chrono::microseconds(5000) : chrono::microseconds(100);
+   		if (future.wait_for(poll) == future_status::ready) {
   			cmd = future.get();
   			if (cmd != "quit")
   				future = async(launch::async, GetLineSync);
@@ -218,27 +479,62 @@ void UCIloop(int argc, char* argv[]) {
       is >> skipws >> token;
 
       if (    token == "quit"
-          ||  token == "stop")
-          g.stopSearchMPI();
+          ||  token == "stop") {
+          g.stopSearchMPI(); // a ponder miss ends here, the halted result is printed and dropped by the GUI
+          limits.ponder = false;
+      }
+      else if (token == "ponderhit") { // keep the running search, it now counts against our clock
+          limits.ponder = false;
+          limits.startTime = now();
+      }
 
       else if (token == "uci") {
           cout << "id name " << "MULLER1" << endl;
           cout << "id author " << "CH" << "\n"       //<< Options
 			<< "option name Posscore type check default false\n"
+			<< "option name Ponder type check default false\n"
+			<< "option name EvalCacheBits type spin default " << ENG_EVAL_CACHE_BITS << " min 0 max 24\n"
+			<< "option name PawnHashBits type spin default " << ENG_PAWN_HASH_BITS << " min 0 max 22\n"
+			<< "option name MultiPV type spin default 1 min 1 max 256\n"
+			<< "option name BookFile type string default <empty>\n"
+			<< "option name JobBatch type spin default " << cluster.capacity << " min 1 max " << JOB_MAX_BATCH << "\n"
+			<< "option name Threads type spin default " << cpu_count - 1 << " min 1 max 1024\n"
 			<< "uciok"  << endl;
       }
       else if (token == "setoption")  UCIsetoption(is);
       else if (token == "go")         UCIgo(g, is);
       else if (token == "position")   UCIposition(g, is);
-      else if (token == "ucinewgame") g.stopSearchMPI();
+      else if (token == "ucinewgame") {
+          g.stopSearchMPI();
+          g.subtree_owner.clear();
+          cluster.clearTables();
+      }
       else if (token == "isready")    cout << "readyok" << endl;
+      else if (token == "debug")      is >> token, limits.debug_mainline = token == "on";
 
       // Additional custom non-UCI commands, mainly for debugging
       //else if (token == "flip")  pos.flip();
-      //else if (token == "bench") bench(pos, is, states);
+      else if (token == "bench")      UCIbench(is);
+      else if (token == "epd")        UCIepd(is);
+      else if (token == "match")      UCImatch(is);
+      else if (token == "analyze")    UCIanalyze(is);
+      else if (token == "datagen")    UCIdatagen(is);
+      else if (token == "datastat")   UCIdatastat(is);
+      else if (token == "stats")      UCIstats(is);
+      else if (token == "server") {
+          string path = "muller.sock";
+          int max_sessions = 64;
+          is >> path >> max_sessions;
+          runServer(path, max_sessions);
+      }
       else if (token == "d") {
     	  cout << "History: " << g.board_history.size() << " MateSearch: " << limits.mate_search << " posscore: " << limits.pos_score_enabled << " depth: " << limits.depth <<endl;
     	  g.current.print(g.checkRepetition());
+    	  cout << "EvalCache: " << limits.eval_cache_bits << " bits, " << (100 * g.eval_hits) / max<uint64_t>(1, g.eval_probes) << "% of " << g.eval_probes
+    			  << " hit. PawnHash: " << limits.pawn_hash_bits << " bits, " << (100 * g.pawn_hits) / max<uint64_t>(1, g.pawn_probes) << "% of " << g.pawn_probes << " hit" << endl;
+#ifdef ENG_STATS
+    	  printSearchStats();
+#endif
       }
       //else if (token == "eval")  cout << Eval::trace(pos) << endl;
       else